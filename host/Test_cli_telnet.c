@@ -0,0 +1,245 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "unity.h"
+
+#include "cli_internal.h"
+#include "cli_telnet_internal.h"
+
+static struct cli_telnet telnet;
+static struct telnet_conn conn;
+
+// filtered input as a string
+static const char *in_get(void)
+{
+	conn.in[conn.in_len] = '\0';
+	conn.in_len = 0;
+	return conn.in;
+}
+
+static void filter(const char *s, size_t len)
+{
+	telnet_filter(&conn, (const uint8_t *) s, len);
+}
+
+void setUp(void)
+{
+	memset(&telnet, 0, sizeof(telnet));
+	memset(&conn, 0, sizeof(conn));
+	conn.fd = -1;
+	conn.t = &telnet;
+}
+
+void tearDown(void)
+{
+	free(conn.out);
+}
+
+void test_telnet_out_data_iac(void)
+{
+	telnet_out_data(&conn, "a\xff" "b\xff", 4);
+	TEST_ASSERT_EQUAL_size_t(6, conn.out_len);
+	TEST_ASSERT_EQUAL_MEMORY("a\xff\xff" "b\xff\xff", conn.out, 6);
+
+	// raw connections send the data as it is
+	conn.out_len = 0;
+	telnet.raw = true;
+	telnet_out_data(&conn, "a\xff" "b", 3);
+	TEST_ASSERT_EQUAL_size_t(3, conn.out_len);
+	TEST_ASSERT_EQUAL_MEMORY("a\xff" "b", conn.out, 3);
+}
+
+void test_telnet_filter_line_ends(void)
+{
+	// CR LF, CR NUL and LF all end a line with CR
+	filter("ab\r\nc\r\0d\ne", 10);
+	TEST_ASSERT_EQUAL_STRING("ab\rc\rd\re", in_get());
+
+	// CR and LF in different packets
+	filter("f\r", 2);
+	filter("\ng", 2);
+	TEST_ASSERT_EQUAL_STRING("f\rg", in_get());
+
+	// empty lines are kept
+	filter("\r\n\r\n", 4);
+	TEST_ASSERT_EQUAL_STRING("\r\r", in_get());
+}
+
+void test_telnet_filter_commands(void)
+{
+	// IAC IAC is data, IP is Ctrl-C, NOP is dropped
+	filter("a\xff\xff" "b\xff\xf4" "c\xff\xf1" "d", 10);
+	TEST_ASSERT_EQUAL_STRING("a\xff" "b\x03" "c" "d", in_get());
+
+	// command split over packets
+	filter("a\xff", 2);
+	filter("\xf4" "b", 2);
+	TEST_ASSERT_EQUAL_STRING("a\x03" "b", in_get());
+	TEST_ASSERT_EQUAL_size_t(0, conn.out_len);
+}
+
+void test_telnet_filter_options(void)
+{
+	// DO TTYPE and WILL NAWS are refused, ECHO and SGA the server
+	// offered are not answered, so the negotiation cant loop
+	filter("\xff\xfd\x18" "\xff\xfb\x1f" "\xff\xfd\x01" "\xff\xfd\x03"
+	       "\xff\xfb\x03" "\xff\xfe\x05" "a", 19);
+	TEST_ASSERT_EQUAL_STRING("a", in_get());
+	TEST_ASSERT_EQUAL_size_t(6, conn.out_len);
+	TEST_ASSERT_EQUAL_MEMORY("\xff\xfc\x18" "\xff\xfe\x1f", conn.out, 6);
+}
+
+void test_telnet_filter_sub_negotiation(void)
+{
+	// IAC SB ... IAC SE is skipped, IAC SE may come in the next packet
+	filter("a\xff\xfa\x18\x00" "xterm\xff", 11);
+	filter("\xf0" "b", 2);
+	TEST_ASSERT_EQUAL_STRING("ab", in_get());
+
+	// IAC IAC inside does not end it
+	filter("\xff\xfa\x1f\xff\xff\x01\xff\xf0" "c", 9);
+	TEST_ASSERT_EQUAL_STRING("c", in_get());
+	TEST_ASSERT_EQUAL_size_t(0, conn.out_len);
+}
+
+void test_telnet_filter_raw(void)
+{
+	telnet.raw = true;
+	filter("a\xff\xf4" "b\r\n", 6);
+	TEST_ASSERT_EQUAL_STRING("a\xff\xf4" "b\r", in_get());
+	TEST_ASSERT_EQUAL_size_t(0, conn.out_len);
+}
+
+static uint32_t count_cancel_cnt;
+
+// never ends until cancelled
+static bool count_step(struct cli *cli, char *s, uint32_t step)
+{
+	(void) cli;
+	(void) s;
+	if (CLI_STEP_CANCEL == step)
+	{
+		count_cancel_cnt += 1;
+		return false;
+	}
+	return true;
+}
+
+static bool no_char(char *c)
+{
+	(void) c;
+	return false;
+}
+
+static void no_send(char c)
+{
+	(void) c;
+}
+
+static int client_connect(uint16_t port)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	TEST_ASSERT_TRUE(0 <= fd);
+	TEST_ASSERT_EQUAL_INT(0, connect(fd, (struct sockaddr *) &addr,
+					 sizeof(addr)));
+	return fd;
+}
+
+// runs the front-end until the session count is cnt
+static void run_until(struct cli_telnet *t, uint32_t cnt)
+{
+	for (uint32_t i = 0; 100 > i && cnt != cli_telnet_session_cnt(t);
+	     i++)
+	{
+		TEST_ASSERT_TRUE(cli_telnet_run(t, 10));
+	}
+	TEST_ASSERT_EQUAL_UINT32(cnt, cli_telnet_session_cnt(t));
+}
+
+void test_telnet_session_reuse(void)
+{
+	struct cli_settings s = {
+		.my_malloc = malloc,
+		.get_char = no_char,
+		.send_char = no_send,
+		.input_end_char = '\r',
+		.prompt_user = "> ",
+	};
+	struct cli *cli = cli_init(&s);
+	TEST_ASSERT_NOT_NULL(cli);
+	TEST_ASSERT_TRUE(cli_add_cmd_common(cli, (struct cli_cmd_settings) {
+				.command_name = "count",
+				.command_step = count_step,
+			}));
+
+	struct cli_telnet_settings ts = {
+		.port = 0,
+		.max_sessions = 1,
+		.raw = true,
+	};
+	struct cli_telnet *t = cli_telnet_init(cli, &ts);
+	TEST_ASSERT_NOT_NULL(t);
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	TEST_ASSERT_EQUAL_INT(0, getsockname(t->listen_fd,
+					     (struct sockaddr *) &addr, &len));
+	uint16_t port = ntohs(addr.sin_port);
+
+	int fd = client_connect(port);
+	run_until(t, 1);
+	struct cli *session = t->conns[0].cli;
+	TEST_ASSERT_NOT_NULL(session);
+
+	// connections over max_sessions are refused
+	int fd2 = client_connect(port);
+	char b[64];
+	ssize_t n = 0;
+	for (uint32_t i = 0; 100 > i && 0 >= n; i++)
+	{
+		TEST_ASSERT_TRUE(cli_telnet_run(t, 10));
+		n = recv(fd2, b, sizeof(b) - 1, MSG_DONTWAIT);
+	}
+	TEST_ASSERT_TRUE(0 < n);
+	b[n] = '\0';
+	TEST_ASSERT_EQUAL_STRING("too many sessions\r\n", b);
+	close(fd2);
+
+	// running command is cancelled when the connection closes
+	TEST_ASSERT_EQUAL_INT(7, send(fd, "count\r\n", 7, 0));
+	for (uint32_t i = 0; 100 > i && NULL == session->running_cmd; i++)
+	{
+		TEST_ASSERT_TRUE(cli_telnet_run(t, 10));
+	}
+	TEST_ASSERT_NOT_NULL(session->running_cmd);
+	close(fd);
+	run_until(t, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, count_cancel_cnt);
+	TEST_ASSERT_NULL(session->running_cmd);
+
+	// next connection gets the same session
+	fd = client_connect(port);
+	run_until(t, 1);
+	TEST_ASSERT_EQUAL_PTR(session, t->conns[0].cli);
+
+	close(fd);
+	cli_telnet_deinit(t);
+}
@@ -0,0 +1,625 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "cli_telnet_internal.h"
+
+// cli callbacks have no context. Sessions run one at a time in the
+// thread of their instance, and the callbacks use the connection of
+// the running one. Set only while cli is called
+static _Thread_local struct telnet_conn *telnet_current;
+
+STATIC uint64_t telnet_time_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((uint64_t) t.tv_sec * 1000u)
+		+ ((uint64_t) t.tv_nsec / 1000000u);
+}
+
+STATIC void telnet_out(struct telnet_conn *c, const char *buf, size_t len)
+{
+	if (c->out_size < c->out_len + len)
+	{
+		size_t size = c->out_size ? c->out_size : 256;
+		for (; size < c->out_len + len; size *= 2);
+
+		char *out = realloc(c->out, size);
+		if (NULL == out)
+		{
+			// output is dropped, the session keeps running
+			return;
+		}
+		c->out = out;
+		c->out_size = size;
+	}
+	memcpy(&c->out[c->out_len], buf, len);
+	c->out_len += len;
+}
+
+// IAC in the data is sent twice
+STATIC void telnet_out_data(struct telnet_conn *c, const char *buf,
+			    size_t len)
+{
+	while (len)
+	{
+		size_t n = 0;
+		for (; len > n 
+			     && (c->t->raw || TELNET_IAC != (uint8_t) buf[n]);
+		     n++);
+		if (len > n)
+		{
+			// IAC is sent with the block and once more after it
+			n += 1;
+			telnet_out(c, buf, n);
+			telnet_out(c, &buf[n - 1], 1);
+		}
+		else
+		{
+			telnet_out(c, buf, n);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+STATIC void telnet_out_cmd(struct telnet_conn *c, uint8_t cmd, uint8_t opt)
+{
+	const char b[3] = { (char) TELNET_IAC, (char) cmd, (char) opt };
+	telnet_out(c, b, sizeof(b));
+}
+
+STATIC bool telnet_get_char(char *ch)
+{
+	struct telnet_conn *c = telnet_current;
+	if (c->in_len > c->in_index)
+	{
+		*ch = c->in[c->in_index];
+		c->in_index += 1;
+		return true;
+	}
+	return false;
+}
+
+#ifdef ENABLE_BULK_INPUT
+STATIC size_t telnet_get_buf(char *buf, size_t size)
+{
+	struct telnet_conn *c = telnet_current;
+	size_t n = c->in_len - c->in_index;
+	if (n > size)
+	{
+		n = size;
+	}
+	memcpy(buf, &c->in[c->in_index], n);
+	c->in_index += n;
+	return n;
+}
+#endif
+
+STATIC void telnet_send_char(char ch)
+{
+	telnet_out_data(telnet_current, &ch, 1);
+}
+
+#ifdef ENABLE_OUTPUT_BUFFER
+STATIC void telnet_send_buf(const char *buf, size_t len)
+{
+	telnet_out_data(telnet_current, buf, len);
+}
+#endif
+
+#ifdef ENABLE_STREAMING_OUTPUT
+STATIC size_t telnet_send_space(void)
+{
+	struct telnet_conn *c = telnet_current;
+	return (CLI_TELNET_OUT_LIMIT > c->out_len)
+		? CLI_TELNET_OUT_LIMIT - c->out_len : 0;
+}
+#endif
+
+STATIC void telnet_in(struct telnet_conn *c, char ch)
+{
+	c->in[c->in_len] = ch;
+	c->in_len += 1;
+}
+
+// Line ends are given to cli as CR. Telnet sends CR LF or CR NUL,
+// scripts often only LF
+STATIC void telnet_in_data(struct telnet_conn *c, char ch)
+{
+	bool cr = c->cr;
+	c->cr = '\r' == ch;
+
+	if (cr && ('\n' == ch || '\0' == ch))
+	{
+		return;
+	}
+	telnet_in(c, ('\n' == ch) ? '\r' : ch);
+}
+
+// answers only the options the server didnt ask for, so the
+// negotiation cant loop
+STATIC void telnet_option(struct telnet_conn *c, uint8_t cmd, uint8_t opt)
+{
+	if (TELNET_DO == cmd
+	    && TELNET_OPT_ECHO != opt && TELNET_OPT_SGA != opt)
+	{
+		telnet_out_cmd(c, TELNET_WONT, opt);
+	}
+	else if (TELNET_WILL == cmd && TELNET_OPT_SGA != opt)
+	{
+		telnet_out_cmd(c, TELNET_DONT, opt);
+	}
+}
+
+STATIC void telnet_filter(struct telnet_conn *c, const uint8_t *buf,
+			  size_t len)
+{
+	for (size_t i = 0; len > i; i++)
+	{
+		uint8_t b = buf[i];
+
+		if (c->t->raw)
+		{
+			telnet_in_data(c, (char) b);
+			continue;
+		}
+
+		switch (c->state)
+		{
+		case TELNET_DATA:
+			if (TELNET_IAC == b)
+			{
+				c->state = TELNET_CMD;
+			}
+			else
+			{
+				telnet_in_data(c, (char) b);
+			}
+			break;
+		case TELNET_CMD:
+			c->state = TELNET_DATA;
+			if (TELNET_IAC == b)
+			{
+				telnet_in_data(c, (char) b);
+			}
+			else if (TELNET_IP == b)
+			{
+				// interrupt process, same as Ctrl-C
+				telnet_in_data(c, '\x03');
+			}
+			else if (TELNET_SB == b)
+			{
+				c->state = TELNET_SUB;
+			}
+			else if (TELNET_WILL <= b)
+			{
+				c->cmd = b;
+				c->state = TELNET_OPT;
+			}
+			break;
+		case TELNET_OPT:
+			telnet_option(c, c->cmd, b);
+			c->state = TELNET_DATA;
+			break;
+		case TELNET_SUB:
+			if (TELNET_IAC == b)
+			{
+				c->state = TELNET_SUB_IAC;
+			}
+			break;
+		case TELNET_SUB_IAC:
+			c->state = (TELNET_SE == b) ? TELNET_DATA : TELNET_SUB;
+			break;
+		default:
+			c->state = TELNET_DATA;
+			break;
+		}
+	}
+}
+
+STATIC void telnet_events_set(struct cli_telnet *t, struct telnet_conn *c)
+{
+	uint32_t events = 0;
+	if (CLI_TELNET_IN_SIZE > c->in_len)
+	{
+		events |= EPOLLIN;
+	}
+	if (c->out_len)
+	{
+		events |= EPOLLOUT;
+	}
+
+	if (events != c->events)
+	{
+		struct epoll_event ev = { .events = events, .data.ptr = c };
+		epoll_ctl(t->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+		c->events = events;
+	}
+}
+
+// returns false if the connection is broken
+STATIC bool telnet_flush(struct telnet_conn *c)
+{
+	size_t sent = 0;
+	while (c->out_len > sent)
+	{
+		ssize_t n = send(c->fd, &c->out[sent], c->out_len - sent,
+				 MSG_NOSIGNAL);
+		if (0 > n)
+		{
+			if (EINTR == errno)
+			{
+				continue;
+			}
+			if (EAGAIN != errno && EWOULDBLOCK != errno)
+			{
+				return false;
+			}
+			break;
+		}
+		sent += (size_t) n;
+	}
+
+	if (sent)
+	{
+		memmove(c->out, &c->out[sent], c->out_len - sent);
+		c->out_len -= sent;
+	}
+	return true;
+}
+
+STATIC void telnet_close(struct cli_telnet *t, struct telnet_conn *c)
+{
+	epoll_ctl(t->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+
+	// session is reset before the slot can be reused, a running
+	// resumable command gets its CLI_STEP_CANCEL step here. Its
+	// output has nowhere to go and is dropped
+	telnet_current = c;
+	cli_session_reset(c->cli);
+	telnet_current = NULL;
+	c->out_len = 0;
+
+	c->next_free = t->free;
+	t->free = c;
+	t->session_cnt -= 1;
+}
+
+// returns false if the connection is closed
+STATIC bool telnet_read(struct cli_telnet *t, struct telnet_conn *c)
+{
+	// input already given to cli is dropped
+	memmove(c->in, &c->in[c->in_index], c->in_len - c->in_index);
+	c->in_len -= c->in_index;
+	c->in_index = 0;
+	if (CLI_TELNET_IN_SIZE == c->in_len)
+	{
+		return true;
+	}
+
+	// filtered input is never longer than the received data
+	uint8_t buf[CLI_TELNET_IN_SIZE];
+	ssize_t n = recv(c->fd, buf, CLI_TELNET_IN_SIZE - c->in_len, 0);
+	if (0 > n && (EAGAIN == errno || EWOULDBLOCK == errno
+		      || EINTR == errno))
+	{
+		return true;
+	}
+	if (0 >= n)
+	{
+		telnet_close(t, c);
+		return false;
+	}
+
+	telnet_filter(c, buf, (size_t) n);
+	return true;
+}
+
+STATIC bool telnet_session_start(struct cli_telnet *t,
+				 struct telnet_conn *c)
+{
+	if (NULL == c->cli)
+	{
+		struct cli_settings s = {
+			.get_char = telnet_get_char,
+#ifdef ENABLE_BULK_INPUT
+			.get_buf = telnet_get_buf,
+#endif
+			.send_char = telnet_send_char,
+#ifdef ENABLE_OUTPUT_BUFFER
+			.send_buf = telnet_send_buf,
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+			.send_space = telnet_send_space,
+#endif
+			.input_end_char = '\r',
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+			.logout_time_ms = t->logout_time_ms,
+#endif
+		};
+		c->cli = cli_add_session(t->cli, &s);
+	}
+
+	c->state = TELNET_DATA;
+	c->cr = false;
+	c->in_index = 0;
+	c->in_len = 0;
+	c->out_len = 0;
+	c->last_run_ms = telnet_time_ms();
+	c->next_run_ms = 0;
+
+	if (!t->raw)
+	{
+		// server echoes and sends characters as they are typed
+		telnet_out_cmd(c, TELNET_WILL, TELNET_OPT_ECHO);
+		telnet_out_cmd(c, TELNET_WILL, TELNET_OPT_SGA);
+		telnet_out_cmd(c, TELNET_DO, TELNET_OPT_SGA);
+	}
+	// empty line prints the prompt
+	telnet_in(c, '\r');
+
+	return NULL != c->cli;
+}
+
+STATIC void telnet_accept(struct cli_telnet *t)
+{
+	for (;;)
+	{
+		int fd = accept(t->listen_fd, NULL, NULL);
+		if (0 > fd)
+		{
+			// EAGAIN when all are accepted
+			return;
+		}
+
+		struct telnet_conn *c = t->free;
+		if (NULL == c || 0 > fcntl(fd, F_SETFL, O_NONBLOCK))
+		{
+			static const char msg[] = "too many sessions\r\n";
+			send(fd, msg, sizeof(msg) - 1,
+			     MSG_NOSIGNAL | MSG_DONTWAIT);
+			close(fd);
+			continue;
+		}
+
+		if (!telnet_session_start(t, c))
+		{
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->events = EPOLLIN;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		if (0 > epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		{
+			close(fd);
+			c->fd = -1;
+			continue;
+		}
+		t->free = c->next_free;
+		t->session_cnt += 1;
+	}
+}
+
+// session is run when it has new input or cli_run asked for it
+STATIC bool telnet_session_due(struct telnet_conn *c, uint64_t now)
+{
+	if (c->in_len > c->in_index)
+	{
+		return true;
+	}
+	// output is left only when the socket is full, next steps wait
+	// until it takes the output
+	if (c->out_len)
+	{
+		return false;
+	}
+	return CLI_RUN_IDLE != c->next_run_ms
+		&& now - c->last_run_ms >= c->next_run_ms;
+}
+
+STATIC void telnet_session_run(struct cli_telnet *t,
+			       struct telnet_conn *c, uint64_t now)
+{
+	telnet_current = c;
+	c->next_run_ms = cli_run(c->cli, (uint32_t) (now - c->last_run_ms));
+	telnet_current = NULL;
+	c->last_run_ms = now;
+
+	if (!telnet_flush(c))
+	{
+		telnet_close(t, c);
+		return;
+	}
+	telnet_events_set(t, c);
+}
+
+// ms until the next session is due, at most timeout_ms
+STATIC int telnet_timeout(struct cli_telnet *t, int timeout_ms,
+			  uint64_t now)
+{
+	for (uint32_t i = 0; t->max_sessions > i && 0 != timeout_ms; i++)
+	{
+		struct telnet_conn *c = &t->conns[i];
+		if (0 > c->fd)
+		{
+			continue;
+		}
+		if (telnet_session_due(c, now))
+		{
+			return 0;
+		}
+		if (CLI_RUN_IDLE == c->next_run_ms)
+		{
+			continue;
+		}
+
+		uint64_t due = c->last_run_ms + c->next_run_ms;
+		if (due > now && (0 > timeout_ms
+				  || (uint64_t) timeout_ms > due - now))
+		{
+			timeout_ms = (int) (due - now);
+		}
+	}
+	return timeout_ms;
+}
+
+bool cli_telnet_run(struct cli_telnet *t, int timeout_ms)
+{
+	struct epoll_event ev[CLI_TELNET_EVENT_CNT];
+
+	timeout_ms = telnet_timeout(t, timeout_ms, telnet_time_ms());
+	int n = epoll_wait(t->epoll_fd, ev, CLI_TELNET_EVENT_CNT, timeout_ms);
+	if (0 > n)
+	{
+		return EINTR == errno;
+	}
+
+	for (int i = 0; n > i; i++)
+	{
+		struct telnet_conn *c = ev[i].data.ptr;
+		if (NULL == c)
+		{
+			telnet_accept(t);
+			continue;
+		}
+
+		if ((ev[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		    && !telnet_read(t, c))
+		{
+			continue;
+		}
+		if ((ev[i].events & EPOLLOUT) && !telnet_flush(c))
+		{
+			telnet_close(t, c);
+			continue;
+		}
+		telnet_events_set(t, c);
+	}
+
+	uint64_t now = telnet_time_ms();
+	for (uint32_t i = 0; t->max_sessions > i; i++)
+	{
+		struct telnet_conn *c = &t->conns[i];
+		if (0 <= c->fd && telnet_session_due(c, now))
+		{
+			telnet_session_run(t, c, now);
+		}
+	}
+	return true;
+}
+
+struct cli_telnet *cli_telnet_init(struct cli *cli,
+				   struct cli_telnet_settings *s)
+{
+	if (NULL == cli || NULL == s || 0 == s->max_sessions)
+	{
+		return NULL;
+	}
+
+	struct cli_telnet *t = calloc(1, sizeof(struct cli_telnet));
+	if (NULL == t)
+	{
+		return NULL;
+	}
+	t->cli = cli;
+	t->raw = s->raw;
+	t->logout_time_ms = s->logout_time_ms;
+	t->max_sessions = s->max_sessions;
+	t->conns = calloc(s->max_sessions, sizeof(struct telnet_conn));
+	t->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	t->epoll_fd = epoll_create1(0);
+	if (NULL == t->conns || 0 > t->listen_fd || 0 > t->epoll_fd)
+	{
+		goto error;
+	}
+
+	for (uint32_t i = s->max_sessions; 0 < i; i--)
+	{
+		struct telnet_conn *c = &t->conns[i - 1];
+		c->fd = -1;
+		c->t = t;
+		c->next_free = t->free;
+		t->free = c;
+	}
+
+	int on = 1;
+	setsockopt(t->listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(s->port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if (0 > bind(t->listen_fd, (struct sockaddr *) &addr, sizeof(addr))
+	    || 0 > listen(t->listen_fd, SOMAXCONN)
+	    || 0 > epoll_ctl(t->epoll_fd, EPOLL_CTL_ADD, t->listen_fd, &ev))
+	{
+		goto error;
+	}
+	return t;
+
+error:
+	if (0 <= t->listen_fd)
+	{
+		close(t->listen_fd);
+	}
+	if (0 <= t->epoll_fd)
+	{
+		close(t->epoll_fd);
+	}
+	free(t->conns);
+	free(t);
+	return NULL;
+}
+
+void cli_telnet_deinit(struct cli_telnet *t)
+{
+	if (NULL == t)
+	{
+		return;
+	}
+
+	for (uint32_t i = 0; t->max_sessions > i; i++)
+	{
+		struct telnet_conn *c = &t->conns[i];
+		if (0 <= c->fd)
+		{
+			telnet_close(t, c);
+		}
+		free(c->out);
+	}
+	close(t->listen_fd);
+	close(t->epoll_fd);
+	free(t->conns);
+	free(t);
+}
+
+int cli_telnet_fd(struct cli_telnet *t)
+{
+	return t->epoll_fd;
+}
+
+uint32_t cli_telnet_session_cnt(struct cli_telnet *t)
+{
+	return t->session_cnt;
+}
@@ -0,0 +1,51 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef CLI_TELNET_H
+#define CLI_TELNET_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "cli.h"
+
+// Linux host front-end, serves cli sessions over TCP on localhost.
+// One thread, all the sockets are non blocking and handled with epoll
+
+struct cli_telnet;
+
+struct cli_telnet_settings {
+	// TCP port on 127.0.0.1
+	uint16_t port;
+	// more connections are refused
+	uint32_t max_sessions;
+	// plain TCP without telnet negotiation, for scripted clients
+	bool raw;
+	// used with ENABLE_AUTOMATIC_LOGOUT
+	uint32_t logout_time_ms;
+};
+
+// Starts listening. Sessions are added to the registry of cli when
+// the connections come and are reused after the connections close
+struct cli_telnet *cli_telnet_init(struct cli *cli,
+				   struct cli_telnet_settings *s);
+
+// Waits for the socket events up to timeout_ms (or less if a session
+// has a command step or the logout pending) and runs the sessions
+// with new input. Returns false on epoll error
+bool cli_telnet_run(struct cli_telnet *t, int timeout_ms);
+
+// Closes the connections and the listening socket and frees the
+// front-end. Sessions stay in the registry of cli, reset to the guest
+// user, as cli never frees them
+void cli_telnet_deinit(struct cli_telnet *t);
+
+// epoll fd, can be added to the application's own poll loop
+int cli_telnet_fd(struct cli_telnet *t);
+
+uint32_t cli_telnet_session_cnt(struct cli_telnet *t);
+
+#endif
@@ -0,0 +1,165 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Example of the host front-end: serves the shell on 127.0.0.1 until
+// Ctrl-C. Usage: cli_telnet_demo [-p port] [-n max_sessions] [-r]
+// Connect with: telnet 127.0.0.1 2323 (or nc 127.0.0.1 2323 with -r)
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cli.h"
+#include "cli_telnet.h"
+
+#ifndef ENABLE_PRINTF
+#error E: Demo commands need printf module
+#endif
+
+// lines printed by one step of the count command
+#define DEMO_COUNT_STEP_LINES 16u
+
+static volatile sig_atomic_t demo_stop;
+
+static void demo_signal(int sig)
+{
+	(void) sig;
+	demo_stop = 1;
+}
+
+// first session is not connected, commands run over TCP only
+static bool demo_get_char(char *c)
+{
+	(void) c;
+	return false;
+}
+
+static void demo_send_char(char c)
+{
+	putchar(c);
+}
+
+// first argument of the command, NULL if none
+static char *demo_arg(struct cli *cli, char *s)
+{
+#ifdef ENABLE_ARGUMENT_PARSER
+	// parser splits the input in place
+	(void) s;
+	return cli_argumument_parser_get_next(cli, 1);
+#else
+	(void) cli;
+	char *arg = strchr(s, ' ');
+	return arg ? arg + 1 : NULL;
+#endif
+}
+
+static void demo_echo(struct cli *cli, char *s)
+{
+	char *arg = demo_arg(cli, s);
+	cli_printf(cli, "%s\r\n", arg ? arg : "");
+}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+// count [n], prints n lines (default 1000). Step number is the only
+// state, so the command works in many sessions at once
+static bool demo_count_step(struct cli *cli, char *s, uint32_t step)
+{
+	char *arg = demo_arg(cli, s);
+	uint32_t n = arg ? (uint32_t) strtoul(arg, NULL, 10) : 1000u;
+
+	if (CLI_STEP_CANCEL == step)
+	{
+		return false;
+	}
+
+	uint32_t i = step * DEMO_COUNT_STEP_LINES;
+	for (uint32_t end = i + DEMO_COUNT_STEP_LINES; n > i && end > i; i++)
+	{
+		cli_printf(cli, "line %u\r\n", i);
+	}
+	return n > i;
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+	struct cli_telnet_settings ts = {
+		.port = 2323,
+		.max_sessions = 256,
+		.raw = false,
+	};
+
+	int opt;
+	while (-1 != (opt = getopt(argc, argv, "p:n:r")))
+	{
+		switch (opt)
+		{
+		case 'p':
+			ts.port = (uint16_t) strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			ts.max_sessions = (uint32_t) strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			ts.raw = true;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-n max_sessions]"
+				" [-r]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	struct cli_settings s = {
+		.my_malloc = malloc,
+		.get_char = demo_get_char,
+		.send_char = demo_send_char,
+		.input_end_char = '\r',
+		.prompt_user = "sim> ",
+	};
+	struct cli *cli = cli_init(&s);
+	if (NULL == cli)
+	{
+		return 1;
+	}
+
+	static const struct cli_cmd_settings cmds[] = {
+		{
+			.command_name = "echo",
+			.command_description = "echo <word>, prints the word",
+			.command_function = demo_echo,
+		},
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		{
+			.command_name = "count",
+			.command_description = "count [n], prints n lines",
+			.command_step = demo_count_step,
+		},
+#endif
+	};
+	cli_add_cmds(cli, cmds, sizeof(cmds) / sizeof(cmds[0]));
+
+	struct cli_telnet *t = cli_telnet_init(cli, &ts);
+	if (NULL == t)
+	{
+		perror("cli_telnet_init");
+		return 1;
+	}
+	printf("listening on 127.0.0.1:%u\n", ts.port);
+	fflush(stdout);
+
+	signal(SIGINT, demo_signal);
+	signal(SIGTERM, demo_signal);
+	while (!demo_stop && cli_telnet_run(t, 1000));
+
+	printf("stopped with %u sessions\n", cli_telnet_session_cnt(t));
+	cli_telnet_deinit(t);
+	return 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#ifndef CLI_TELNET_INTERNAL_H
+#define CLI_TELNET_INTERNAL_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cli_telnet.h"
+
+#ifdef UNIT_TESTS
+#define STATIC
+#else
+#define STATIC static
+#endif
+
+#ifndef CLI_TELNET_IN_SIZE
+#define CLI_TELNET_IN_SIZE 512
+#endif
+
+#ifndef CLI_TELNET_OUT_LIMIT
+// space reported to cli with streaming output
+#define CLI_TELNET_OUT_LIMIT 4096
+#endif
+
+#define CLI_TELNET_EVENT_CNT 64
+
+#define TELNET_SE 240
+#define TELNET_IP 244
+#define TELNET_SB 250
+#define TELNET_WILL 251
+#define TELNET_WONT 252
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_IAC 255
+
+#define TELNET_OPT_ECHO 1
+#define TELNET_OPT_SGA 3
+
+enum telnet_state {
+	TELNET_DATA,
+	TELNET_CMD,	// after IAC
+	TELNET_OPT,	// after IAC WILL/WONT/DO/DONT
+	TELNET_SUB,	// in IAC SB ... IAC SE
+	TELNET_SUB_IAC,
+};
+
+struct telnet_conn {
+	int fd;
+	// NULL until the slot is used for the first time
+	struct cli *cli;
+	struct cli_telnet *t;
+	struct telnet_conn *next_free;
+	uint32_t events;
+
+	uint8_t state;
+	uint8_t cmd;
+	// last input character was CR, LF or NUL after it is dropped
+	bool cr;
+
+	// filtered input, read by the cli callbacks
+	char in[CLI_TELNET_IN_SIZE];
+	size_t in_index;
+	size_t in_len;
+
+	// output waiting for the socket
+	char *out;
+	size_t out_len;
+	size_t out_size;
+
+	uint64_t last_run_ms;
+	// returned by cli_run
+	uint32_t next_run_ms;
+};
+
+struct cli_telnet {
+	struct cli *cli;
+	int epoll_fd;
+	int listen_fd;
+	bool raw;
+	uint32_t logout_time_ms;
+
+	struct telnet_conn *conns;
+	struct telnet_conn *free;
+	uint32_t max_sessions;
+	uint32_t session_cnt;
+};
+
+STATIC uint64_t telnet_time_ms(void);
+
+STATIC void telnet_out(struct telnet_conn *c, const char *buf, size_t len);
+STATIC void telnet_out_data(struct telnet_conn *c, const char *buf,
+			    size_t len);
+STATIC void telnet_out_cmd(struct telnet_conn *c, uint8_t cmd, uint8_t opt);
+
+STATIC void telnet_in(struct telnet_conn *c, char ch);
+STATIC void telnet_in_data(struct telnet_conn *c, char ch);
+STATIC void telnet_option(struct telnet_conn *c, uint8_t cmd, uint8_t opt);
+STATIC void telnet_filter(struct telnet_conn *c, const uint8_t *buf,
+			  size_t len);
+
+STATIC void telnet_events_set(struct cli_telnet *t, struct telnet_conn *c);
+STATIC bool telnet_flush(struct telnet_conn *c);
+STATIC void telnet_close(struct cli_telnet *t, struct telnet_conn *c);
+STATIC bool telnet_read(struct cli_telnet *t, struct telnet_conn *c);
+STATIC bool telnet_session_start(struct cli_telnet *t,
+				 struct telnet_conn *c);
+STATIC void telnet_accept(struct cli_telnet *t);
+STATIC bool telnet_session_due(struct telnet_conn *c, uint64_t now);
+STATIC void telnet_session_run(struct cli_telnet *t,
+			       struct telnet_conn *c, uint64_t now);
+STATIC int telnet_timeout(struct cli_telnet *t, int timeout_ms,
+			  uint64_t now);
+
+#endif
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+#
+# SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+# Generates a minimal perfect hash table for the commands added with
+# CLI_COMMAND, CLI_COMMAND_ARGS and CLI_COMMAND_GROUP macros. Used by
+# cli.c when ENABLE_PERFECT_HASH is defined.
+#
+# usage: cli_phash_gen.py [--cpp "cc -E flags"] -o cli_phash.h file.c ...
+#
+# Without --cpp the sources are scanned as text. Comments, literals and
+# macro definitions are skipped, but #if/#ifdef are not evaluated: a
+# CLI_COMMAND in a disabled block still gets a slot and the build fails
+# to link. With --cpp each file is run through the given preprocessor
+# command (use the same defines and include paths as the build) and
+# the expanded commands are taken from its output, so only the enabled
+# ones are in the table.
+#
+# Hash and displace: FNV-1a hash of the name selects a bucket, the
+# bucket seed mixed with the same hash selects the slot. Seeds are
+# chosen so every command gets its own slot. Hash functions here must
+# match the ones in cli.c
+
+import argparse
+import re
+import shlex
+import subprocess
+import sys
+
+CLI_COMMAND_RE = re.compile(r'\bCLI_COMMAND(?:_ARGS|_GROUP)?\s*\(\s*([A-Za-z_]\w*)\s*,')
+# CLI_COMMAND macros after the preprocessor
+CLI_COMMAND_CPP_RE = re.compile(
+    r'\bconst\s+struct\s+cli_cmd\s+cli_cmd_([A-Za-z_]\w*)\s+'
+    r'__attribute__\s*\(\(\s*used\s*,\s*section\s*\(\s*"cli_cmds"')
+# comments, string and character literals
+C_SKIP_RE = re.compile(r'//[^\n]*|/\*.*?\*/|"(?:\\.|[^"\\\n])*"'
+                       r"|'(?:\\.|[^'\\\n])*'", re.S)
+# preprocessor lines with their continuation lines
+C_DIRECTIVE_RE = re.compile(r'^[ \t]*#(?:[^\n]*\\\n)*[^\n]*', re.M)
+MAX_SEED = 0xffff
+
+
+def fnv1a(name):
+    h = 2166136261
+    for c in name.encode():
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+
+def slot_get(h, seed, cnt):
+    x = ((h ^ seed) * 0x9e3779b1) & 0xffffffff
+    x ^= x >> 16
+    return x % cnt
+
+
+def code_get(text):
+    # comments are replaced with a space, literals with an empty
+    # literal, so only the code is left for the command search
+    def skip(m):
+        t = m.group(0)
+        if t.startswith('/'):
+            return ' ' + '\n' * t.count('\n')
+        return t[0] * 2
+
+    return C_DIRECTIVE_RE.sub('', C_SKIP_RE.sub(skip, text))
+
+
+def file_commands_get(f, cpp):
+    if cpp is None:
+        with open(f) as fd:
+            return CLI_COMMAND_RE.findall(code_get(fd.read()))
+
+    r = subprocess.run(shlex.split(cpp) + [f], stdout=subprocess.PIPE,
+                       universal_newlines=True)
+    if r.returncode:
+        sys.exit('E: preprocessor failed on ' + f)
+    return CLI_COMMAND_CPP_RE.findall(r.stdout)
+
+
+def commands_find(files, cpp):
+    names = []
+    for f in files:
+        names += file_commands_get(f, cpp)
+
+    if len(names) != len(set(names)):
+        dup = sorted(n for n in set(names) if names.count(n) > 1)
+        sys.exit('E: duplicated commands: ' + ', '.join(dup))
+    return names
+
+
+def phash_build(names):
+    cnt = len(names)
+    bucket_cnt = max(1, (cnt + 1) // 2)
+
+    buckets = [[] for _ in range(bucket_cnt)]
+    for n in names:
+        buckets[fnv1a(n) % bucket_cnt].append(n)
+
+    seeds = [0] * bucket_cnt
+    slots = [None] * cnt
+
+    # the biggest buckets are the hardest to place, place them first
+    for b in sorted(range(bucket_cnt), key=lambda i: -len(buckets[i])):
+        if not buckets[b]:
+            continue
+        for seed in range(MAX_SEED + 1):
+            s = [slot_get(fnv1a(n), seed, cnt) for n in buckets[b]]
+            if len(set(s)) == len(s) and all(slots[i] is None for i in s):
+                for i, n in zip(s, buckets[b]):
+                    slots[i] = n
+                seeds[b] = seed
+                break
+        else:
+            sys.exit('E: no seed found for bucket %d' % b)
+
+    return seeds, slots
+
+
+def header_write(fd, seeds, slots):
+    fd.write('// Generated by cli_phash_gen.py, do not edit\n\n')
+    fd.write('#ifndef CLI_PHASH_H\n#define CLI_PHASH_H\n\n')
+    fd.write('#define CLI_PHASH_CMD_CNT %du\n' % len(slots))
+    fd.write('#define CLI_PHASH_BUCKET_CNT %du\n\n' % len(seeds))
+
+    if slots:
+        for n in slots:
+            fd.write('extern const struct cli_cmd cli_cmd_%s;\n' % n)
+
+        fd.write('\nstatic const uint16_t '
+                 'cli_phash_seeds[CLI_PHASH_BUCKET_CNT] = {\n')
+        for s in seeds:
+            fd.write('\t%du,\n' % s)
+        fd.write('};\n\n')
+
+        fd.write('static const struct cli_cmd *const '
+                 'cli_phash_cmds[CLI_PHASH_CMD_CNT] = {\n')
+        for n in slots:
+            fd.write('\t&cli_cmd_%s,\n' % n)
+        fd.write('};\n')
+
+    fd.write('\n#endif\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='generate perfect hash for CLI_COMMAND commands')
+    parser.add_argument('-o', '--output', required=True,
+                        help='generated header')
+    parser.add_argument('--cpp',
+                        help='preprocessor command the files are run '
+                        'through, for example "gcc -E -DENABLE_X -Iinc"')
+    parser.add_argument('files', nargs='+',
+                        help='source files with CLI_COMMAND')
+    args = parser.parse_args()
+
+    seeds, slots = phash_build(commands_find(args.files, args.cpp))
+
+    with open(args.output, 'w') as fd:
+        header_write(fd, seeds, slots)
+
+
+if __name__ == '__main__':
+    main()
@@ -31,363 +31,2465 @@ struct cli measure_size_cli_data = {
 
 // this is defined just so the code is more understandable
 // in some places :)
-#define GET_GUEST_USER(cli) (&cli->users)
+#define GET_GUEST_USER(cli) (&cli->reg->users)
 
 
 // cli core functions
-STATIC void echo_string(struct cli *cli, const char *s)
+#ifdef ENABLE_OUTPUT_BUFFER
+STATIC void cli_output_flush(struct cli *cli)
+{
+	if (cli->out_buff_index)
+	{
+		cli->send_buf(cli->out_buff, cli->out_buff_index);
+		cli->out_buff_index = 0;
+	}
+}
+#endif
+
+STATIC void cli_output_send(struct cli *cli, const char *s, size_t len)
 {
-        for (uint32_t i = 0; s[i] != '\0'; i++)
+#ifdef ENABLE_OUTPUT_BUFFER
+	if (cli->send_buf)
+	{
+		while (len)
+		{
+			// big blocks are sent directly, without copying
+			if (0 == cli->out_buff_index 
+			    && CLI_OUTPUT_BUFF_SIZE <= len)
+			{
+				cli->send_buf(s, len);
+				return;
+			}
+
+			size_t n = CLI_OUTPUT_BUFF_SIZE - cli->out_buff_index;
+			if (n > len)
+			{
+				n = len;
+			}
+			memcpy(&cli->out_buff[cli->out_buff_index], s, n);
+			cli->out_buff_index += n;
+			s += n;
+			len -= n;
+
+			if (CLI_OUTPUT_BUFF_SIZE == cli->out_buff_index)
+			{
+				cli_output_flush(cli);
+			}
+		}
+		return;
+	}
+#endif
+        for (size_t i = 0; len > i; i++)
         {
                 cli->send_char(s[i]);
         }
 }
 
-STATIC void echo_input_end_sequence(struct cli *cli)
+#ifdef ENABLE_STREAMING_OUTPUT
+size_t cli_output_space(struct cli *cli)
 {
-	echo_string(cli, "\r\n");
+	if (NULL == cli->send_space)
+	{
+		return SIZE_MAX;
+	}
+
+	size_t space = cli->send_space();
+#ifdef ENABLE_OUTPUT_BUFFER
+	// buffered data is sent before anything new
+	if (cli->send_buf)
+	{
+		space = (space > cli->out_buff_index) 
+			? space - cli->out_buff_index : 0;
+	}
+#endif
+	return space;
 }
+#endif
 
-STATIC bool delete_last_echoed_char(struct cli *cli)
+#ifdef ENABLE_MACHINE_MODE
+STATIC uint16_t cli_crc16(uint16_t crc, uint8_t b)
 {
-	if (cli->input_buff_index)
+	crc ^= (uint16_t) (b << 8);
+	for (uint32_t i = 0; 8 > i; i++)
 	{
-		cli->input_buff_index -= 1;
-		echo_string(cli, "\b \b");
-		return true;
+		crc = (uint16_t) ((crc & 0x8000) ? ((crc << 1) ^ 0x1021) 
+				  : (crc << 1));
 	}
-	return false;
+	return crc;
 }
 
-STATIC bool cli_check_if_command_names_match(struct cli_cmd *cmd01,
-					 char *cmd02_name,
-					 bool match_unfinished_cmds)
+STATIC void cli_machine_send_frame(struct cli *cli, uint8_t type, 
+				   const char *payload, uint8_t len)
 {
-	// we cant use strcmp here, because if match_unfinished_cmds
-	// is set, cmd02_name could be a substring of cmd01 name 
-	if (match_unfinished_cmds)
+	char h[4] = {(char) CLI_FRAME_SOF, (char) type, 
+		     (char) cli->mm_seq, (char) len};
+	uint16_t crc = 0xffff;
+
+	for (uint32_t i = 1; sizeof(h) > i; i++)
 	{
-		size_t cmd_size = strlen(cmd02_name);
-		if (0 == memcmp(cmd01->command_name, 
-				cmd02_name, cmd_size))
-		{
-			return true;
-		}
+		crc = cli_crc16(crc, (uint8_t) h[i]);
 	}
-	else
+	for (uint32_t i = 0; len > i; i++)
 	{
-		size_t cmd_size = strlen(cmd01->command_name);
-		if (0 == memcmp(cmd01->command_name, 
-				cmd02_name, cmd_size)
-		    && (0 == cmd02_name[cmd_size]
-			|| ' ' == cmd02_name[cmd_size]))
-		{
-			return true;
-		}
+		crc = cli_crc16(crc, (uint8_t) payload[i]);
 	}
-	return false;
-}
 
-// the command search function is used for:
-// - search for a command (always return first match)
-// - search for a command substring (match_unfinished_cmds = true)
-//   This is used for autocomplete
-// - count commands that match command substring (name_match_cnt defined)
-// - with search_after_index and found_at_index all commands matching 
-//   command substring can be found. Autocomplete uses this to list
-//   commands that match current input
-STATIC struct cli_cmd *cli_search_command(struct cli *cli, 
-					  char *cmd_name,
-					  bool match_unfinished_cmds,
-					  uint32_t search_after_index,
-					  uint32_t *found_at_index,
-					  uint32_t *name_match_cnt)
-{
-	struct cli_cmd *r = NULL;
-	uint32_t cmd_counter = 0;
-
-	//put user and common cmd list in an array
-        struct cli_cmd *tmp[2] = {
-		&cli->common_cmd_list,
-		cli->current_user->cmd_list};
-
-	//loop over both cmd lists
-	for (uint32_t i = 0; 2 > i; i++)
-	{
-		for (; NULL != tmp[i]; tmp[i] = tmp[i]->next)
-		{
-			// skip first N (search_from_index) cmds
-			if (search_after_index <= cmd_counter)
-			{
-				if (cli_check_if_command_names_match(
-					    tmp[i],
-					    cmd_name,
-					    match_unfinished_cmds))
-				{
-					r = tmp[i];
-
-					if (found_at_index)
-					{
-						*found_at_index = 
-							cmd_counter;
-					}
-
-					if (name_match_cnt)
-					{
-						*name_match_cnt += 1;
-					}
-					else
-					{
-						// goto is the most
-						// effective way for 
-						// exiting double loop
-						goto exit;
-					}
-				}
-			}
-			cmd_counter += 1;
-		}
-	}
-exit:
-        return r;
+	char c[2] = {(char) (crc >> 8), (char) crc};
+	cli_output_send(cli, h, sizeof(h));
+	cli_output_send(cli, payload, len);
+	cli_output_send(cli, c, sizeof(c));
 }
 
-STATIC struct cli_cmd *cli_make_new_cmd(struct cli *cli, 
-			     struct cli_cmd_settings cs)
+STATIC void cli_machine_send_data(struct cli *cli)
 {
-	struct cli_cmd *tmp = cli->malloc(sizeof(struct cli_cmd));
-	tmp->next = NULL;
-	tmp->command_name = cs.command_name;
-	tmp->command_description = cs.command_description;
-	tmp->command_function = cs.command_function;
-	return tmp;
+	if (cli->mm_out_len)
+	{
+		cli_machine_send_frame(cli, CLI_FRAME_DATA, 
+				       cli->mm_out, cli->mm_out_len);
+		cli->mm_out_len = 0;
+	}
 }
 
-STATIC void cli_add_cmd_to_list(struct cli_cmd *list,
-				       struct cli_cmd *new)	       
+// output of the request is collected in DATA frames, anything else
+// (logout message...) is dropped in machine mode
+STATIC void cli_machine_output(struct cli *cli, const char *s, size_t len)
 {
-        struct cli_cmd *tmp = list;
-        for (; NULL != tmp->next; tmp = tmp->next);
-        tmp->next = new;
+	while (cli->mm_busy && len)
+	{
+		size_t n = CLI_MACHINE_DATA_SIZE - cli->mm_out_len;
+		if (n > len)
+		{
+			n = len;
+		}
+		memcpy(&cli->mm_out[cli->mm_out_len], s, n);
+		cli->mm_out_len = (uint8_t) (cli->mm_out_len + n);
+		s += n;
+		len -= n;
+
+		if (CLI_MACHINE_DATA_SIZE == cli->mm_out_len)
+		{
+			cli_machine_send_data(cli);
+		}
+	}
 }
+#endif
 
-bool cli_add_cmd_common(struct cli *cli, struct cli_cmd_settings cs)
+STATIC void cli_output(struct cli *cli, const char *s, size_t len)
 {
-	if ((NULL == cli))
+#ifdef ENABLE_MACHINE_MODE
+	if (cli->mm_enabled)
 	{
-		return false;
+		cli_machine_output(cli, s, len);
+		return;
 	}
+#endif
+	cli_output_send(cli, s, len);
+}
 
-	struct cli_cmd *new = cli_make_new_cmd(cli, cs);
-
-	cli_add_cmd_to_list(&cli->common_cmd_list, new);
-
-	return true;
+STATIC void cli_send_char(struct cli *cli, char c)
+{
+	cli_output(cli, &c, 1);
 }
 
+STATIC void echo_string(struct cli *cli, const char *s)
+{
+	cli_output(cli, s, strlen(s));
+}
 
-STATIC void cli_command_received_handler(struct cli *cli, char *input)
+#ifdef ENABLE_PRINTF
+void cli_write(struct cli *cli, const char *buf, size_t len)
 {
-	struct cli_cmd *tmp_command = 
-		cli_search_command(cli, input, false, 0, NULL, NULL);
+	cli_output(cli, buf, len);
+}
 
-	if (tmp_command)
+// sends n copies of c
+STATIC void cli_print_pad(struct cli *cli, char c, size_t n)
+{
+	char b[8];
+	memset(b, c, sizeof(b));
+	while (n)
 	{
+		size_t k = (n < sizeof(b)) ? n : sizeof(b);
+		cli_output(cli, b, k);
+		n -= k;
+	}
+}
 
-#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
-		cli_history_save_cmd(cli, input);
-#endif
+// sends len characters of s padded to width, sign of a zero padded
+// number goes before the zeros
+STATIC void cli_print_field(struct cli *cli, const char *s, size_t len,
+			    size_t width, bool left, char pad)
+{
+	size_t n = (width > len) ? width - len : 0;
 
-#ifdef ENABLE_ARGUMENT_PARSER
-		cli_argumument_parser_reset(cli);
-#endif
+	if (!left)
+	{
+		if ('0' == pad && len && '-' == *s)
+		{
+			cli_output(cli, s, 1);
+			s++;
+			len--;
+		}
+		cli_print_pad(cli, pad, n);
+	}
+	cli_output(cli, s, len);
+	if (left)
+	{
+		cli_print_pad(cli, ' ', n);
+	}
+}
 
-		tmp_command->command_function(cli, input);
+// reads an integer argument with length modifier size ('H' for hh),
+// signed values are sign extended
+STATIC unsigned long cli_printf_arg(va_list *ap, char size, bool sign)
+{
+	if ('l' == size)
+	{
+		return sign ? (unsigned long) va_arg(*ap, long) 
+			: va_arg(*ap, unsigned long);
+	}
+	if ('z' == size)
+	{
+		return (unsigned long) va_arg(*ap, size_t);
+	}
+	if (!sign)
+	{
+		// shorter types are passed as int
+		unsigned int v = va_arg(*ap, unsigned int);
+		return ('h' == size) ? (unsigned short) v 
+			: ('H' == size) ? (unsigned char) v : v;
 	}
+	int v = va_arg(*ap, int);
+	long s = ('h' == size) ? (short) v 
+		: ('H' == size) ? (signed char) v : v;
+	return (unsigned long) s;
 }
 
-STATIC char *cli_handle_new_character(struct cli *cli, char c,
-				      bool hide_echo)
+// Supports %d %i %u %x %X %c %s %p %% with - and 0 flags, width and 
+// hh, h, l, z modifiers. Numbers are formatted on the stack, text 
+// between the conversions is sent as it is. At any other conversion
+// the rest of fmt is sent as text, so no argument is read wrong
+void cli_vprintf(struct cli *cli, const char *fmt, va_list ap)
 {
-	char *ret = NULL;
+	va_list args;
+	va_copy(args, ap);
 
-        if (cli->input_end_char == c)
+	for (;;)
 	{
-		cli->input_buff[cli->input_buff_index] = '\0';
-
-#ifdef ENABLE_HISTORY_V1
-		if (cli_history_handler_input_v1(cli))
+		size_t n = strcspn(fmt, "%");
+		cli_output(cli, fmt, n);
+		fmt += n;
+		if ('\0' == *fmt || '\0' == fmt[1])
 		{
-			ret = NULL;
+			break;
 		}
-		else
-#endif
+		const char *spec = fmt;
+		fmt += 1;
+
+		bool left = false;
+		char pad = ' ';
+		for (;; fmt++)
 		{
-			ret = cli->input_buff;
-			echo_input_end_sequence(cli);
-			cli->input_buff_index = 0;
+			if ('-' == *fmt)
+			{
+				left = true;
+			}
+			else if ('0' == *fmt)
+			{
+				pad = '0';
+			}
+			else
+			{
+				break;
+			}
 		}
 
-		cli->special_sequence = false;
-		cli->ssb_index = 0;
-        }
-        else if( '\b' == c || 0x7f == c) //backspace
-        {
-		delete_last_echoed_char(cli);
-        }
-        else if( '\r' == c) //drop character
-        {
-                //TODO: Maybe there is a need for droping more than
-		// one character?
-        }
-#if defined(ENABLE_AUTOCOMPLETE)
-        else if( '\t' == c) //tab
-        {
-		cli_autocomplete(cli);
-        }
-#endif
-#if defined(ENABLE_HISTORY_V2)
-	else if (cli_special_sequence_handler(cli, c))
-	{
+		size_t width = 0;
+		for (; '0' <= *fmt && '9' >= *fmt; fmt++)
+		{
+			width = (width * 10) + (size_t) (*fmt - '0');
+		}
 
-	}
-#endif
-        else if ((cli->input_buff_index + 1) < CLI_COMMAND_BUFF_SIZE)
-        {
-                cli->input_buff[cli->input_buff_index] = c;
-                cli->input_buff_index += 1;
+		char size = 0;
+		if ('h' == *fmt || 'l' == *fmt || 'z' == *fmt)
+		{
+			size = *fmt;
+			fmt += 1;
+			if ('h' == size && 'h' == *fmt)
+			{
+				size = 'H';
+				fmt += 1;
+			}
+		}
 
-		if (hide_echo)
+		// digits of unsigned long and sign or 0x
+		char b[(3 * sizeof(unsigned long)) + 2];
+		const char *digits = "0123456789abcdef";
+		const char *str = b;
+		size_t len = 1;
+		unsigned long u = 0;
+		unsigned long base = 10;
+		bool num = true;
+		bool neg = false;
+		bool ptr = false;
+
+		switch (*fmt)
 		{
-			cli->send_char('*');
+		case 'd':
+		case 'i':
+			u = cli_printf_arg(&args, size, true);
+			neg = 0 > (long) u;
+			u = neg ? 0ul - u : u;
+			break;
+		case 'p':
+			u = (unsigned long) (uintptr_t) va_arg(args, void *);
+			base = 16;
+			ptr = true;
+			break;
+		case 'X':
+			digits = "0123456789ABCDEF";
+			// fall through
+		case 'x':
+			base = 16;
+			// fall through
+		case 'u':
+			u = cli_printf_arg(&args, size, false);
+			break;
+		case 's':
+			str = va_arg(args, const char *);
+			if (NULL == str)
+			{
+				str = "(null)";
+			}
+			len = strlen(str);
+			num = false;
+			break;
+		case 'c':
+			b[0] = (char) va_arg(args, int);
+			num = false;
+			break;
+		case '%':
+			b[0] = '%';
+			num = false;
+			break;
+		default:
+			// size of the argument is unknown
+			echo_string(cli, spec);
+			va_end(args);
+			return;
 		}
-		else
+
+		if (num)
 		{
-			cli->send_char(c);
+			size_t i = sizeof(b);
+			do
+			{
+				b[--i] = digits[u % base];
+				u /= base;
+			} while (u);
+			if (neg)
+			{
+				b[--i] = '-';
+			}
+			if (ptr)
+			{
+				b[--i] = 'x';
+				b[--i] = '0';
+			}
+			str = &b[i];
+			len = sizeof(b) - i;
 		}
-        }
-	return ret;
+		cli_print_field(cli, str, len, width, left, 
+				(num && !left && !ptr) ? pad : ' ');
+		fmt += 1;
+	}
+	va_end(args);
 }
 
-
-uint32_t cli_run(struct cli *cli, uint32_t time_from_last_run_ms)
+void cli_printf(struct cli *cli, const char *fmt, ...)
 {
-	(void) time_from_last_run_ms;
-
-#ifdef ENABLE_AUTOMATIC_LOGOUT
-	cli_logout_handler(cli, time_from_last_run_ms);
+	va_list ap;
+	va_start(ap, fmt);
+	cli_vprintf(cli, fmt, ap);
+	va_end(ap);
+}
 #endif
 
-	char c;
-	while(cli->get_char(&c))
-	{
-#ifdef ENABLE_AUTOMATIC_LOGOUT
-		cli_reset_logout_timer(cli);
-#endif
-		bool hide_echo = false;
-		char *input_received = 
-			cli_handle_new_character(cli, c, hide_echo);
-		if (input_received)
-		{
-			cli_command_received_handler(cli, 
-						     input_received);
-			echo_string(cli, cli->current_user->prompt);
-		}
-	} 
+STATIC void echo_input_end_sequence(struct cli *cli)
+{
+	echo_string(cli, "\r\n");
+}
 
-	return 0;
+STATIC bool delete_last_echoed_char(struct cli *cli)
+{
+	if (cli->input_buff_index)
+	{
+		cli->input_buff_index -= 1;
+		echo_string(cli, "\b \b");
+		return true;
+	}
+	return false;
 }
 
+#ifdef ENABLE_STATIC_COMMANDS
+// start and end of the section with commands added by CLI_COMMAND
+// macro. Linker defines them, they are weak so the code links
+// even if there are no static commands
+extern const struct cli_cmd __start_cli_cmds[] __attribute__((weak));
+extern const struct cli_cmd __stop_cli_cmds[] __attribute__((weak));
+#define STATIC_CMDS_START (&__start_cli_cmds[0])
+#define STATIC_CMDS_END (&__stop_cli_cmds[0])
+#endif
 
-STATIC void help_cmd(struct cli *cli, char *s)
+STATIC const struct cli_cmd *cli_cmd_iter_src_first(struct cli *cli,
+						    uint8_t src)
 {
-        (void) s;
-        struct cli_cmd *tmp[2] = {&cli->common_cmd_list,
-		cli->current_user->cmd_list};
-
-	for (uint32_t i = 0; 2 > i; i++)
+	const struct cli_cmd *r = NULL;
+	if (CLI_CMD_SRC_COMMON == src)
+	{
+		r = &cli->reg->common_cmd_list;
+	}
+#ifdef ENABLE_STATIC_COMMANDS
+	else if (CLI_CMD_SRC_STATIC == src)
 	{
-		for (; NULL != tmp[i]; tmp[i] = tmp[i]->next)
+		if (STATIC_CMDS_START != STATIC_CMDS_END)
 		{
-			echo_string(cli, tmp[i]->command_name);
-			echo_string(cli, "\r\n");
-			if (tmp[i]->command_description)
-			{
-				echo_string(cli, "\t");
-				echo_string(
-					cli, 
-					tmp[i]->command_description);
-				echo_string(cli, "\r\n");
-			}
+			r = STATIC_CMDS_START;
 		}
 	}
+#endif
+	else if (CLI_CMD_SRC_USER == src)
+	{
+		r = cli->current_user->cmd_list;
+	}
+	return r;
 }
 
-#if defined(ENABLE_USER_INPUT_REQUEST)
-char *cli_get_user_input(struct cli *cli, bool hide)
+STATIC const struct cli_cmd *cli_cmd_iter_next(struct cli *cli,
+					       struct cli_cmd_iter *it)
 {
-	// TODO: Do we need timeout here?
-	char c;
-	for(;;)
+#ifdef ENABLE_STATIC_COMMANDS
+	if (CLI_CMD_SRC_STATIC == it->src)
 	{
-		if (cli->get_char(&c))
-		{
-			char *input_received = 
-				cli_handle_new_character(cli, c, hide);
-			if (input_received)
-			{
-				return input_received;
-			}
-		}
-#ifdef ENABLE_OS_SUPPORT
-		if (cli->sleep_or_yield)
+		// static commands are stored in an array
+		it->cmd += 1;
+		if (STATIC_CMDS_END == it->cmd)
 		{
-			cli->sleep_or_yield();
+			it->cmd = NULL;
 		}
+	}
+	else
 #endif
-	} 
-	return NULL;
+	{
+		it->cmd = it->cmd->next;
+	}
+
+	while (NULL == it->cmd && CLI_CMD_SRC_CNT > (it->src + 1))
+	{
+		it->src += 1;
+		it->cmd = cli_cmd_iter_src_first(cli, it->src);
+	}
+	return it->cmd;
+}
+
+// iterates over all the commands available to the current user.
+// Order: common commands, static commands, user commands
+STATIC const struct cli_cmd *cli_cmd_iter_first(struct cli *cli,
+						struct cli_cmd_iter *it)
+{
+	// common list is never empty, it starts with help command
+	it->src = CLI_CMD_SRC_COMMON;
+	it->cmd = cli_cmd_iter_src_first(cli, it->src);
+	return it->cmd;
 }
+
+#ifdef ENABLE_PERFECT_HASH
+#ifndef ENABLE_STATIC_COMMANDS
+#error E: Perfect hash needs static commands module
 #endif
 
-struct cli *cli_init(struct cli_settings *s)
+// generated with scripts/cli_phash_gen.py
+#include CLI_PHASH_HEADER
+
+// Static commands are found with one hash of the name and one 
+// string compare. Hash functions must match cli_phash_gen.py
+STATIC const struct cli_cmd *cli_phash_search(const char *name, 
+					      size_t len)
 {
-	if (NULL == s->my_malloc
-	    || NULL == s->get_char
-	    || NULL == s->send_char)
+#if 0 < CLI_PHASH_CMD_CNT
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; len > i; i++)
 	{
-		return NULL;
+		h ^= (uint8_t) name[i];
+		h *= 16777619u;
 	}
-	
-	struct cli *tmp = s->my_malloc(sizeof(struct cli));
 
-	tmp->malloc = s->my_malloc;
-	tmp->get_char = s->get_char;
-	tmp->send_char = s->send_char;
-	tmp->input_buff_index = 0;
-	tmp->common_cmd_list.next = NULL;
-	tmp->common_cmd_list.command_name = "help";
-	tmp->common_cmd_list.command_description = 
-		"print out all the commands";
-	tmp->common_cmd_list.command_function = help_cmd;
-	tmp->input_end_char = s->input_end_char;
-
-	tmp->users.next = NULL;
-	tmp->users.cli = tmp;
-	tmp->users.password_check = NULL;
-	tmp->users.cmd_list = NULL;
-	tmp->users.prompt = s->prompt_user;
-	tmp->users.name = "guest";
-	tmp->current_user = &tmp->users;
+	uint32_t x = (h ^ cli_phash_seeds[h % CLI_PHASH_BUCKET_CNT]) 
+		* 0x9e3779b1u;
+	x ^= x >> 16;
 
-#ifdef ENABLE_OS_SUPPORT
-	tmp->sleep_or_yield = s->sleep_or_yield;
+	const struct cli_cmd *cmd = cli_phash_cmds[x % CLI_PHASH_CMD_CNT];
+	if (0 == strncmp(cmd->command_name, name, len)
+	    && '\0' == cmd->command_name[len])
+	{
+		return cmd;
+	}
+#else
+	(void) name;
+	(void) len;
 #endif
-
-#ifdef ENABLE_AUTOMATIC_LOGOUT
-	tmp->logout_time_ms = s->logout_time_ms;
+	return NULL;
+}
 #endif
 
+STATIC bool cli_cmd_name_starts_with(const struct cli_cmd *cmd,
+				     const char *prefix, size_t len)
+{
+	return 0 == strncmp(cmd->command_name, prefix, len);
+}
+
+#ifdef ENABLE_ROLES
+STATIC bool cli_cmd_visible(struct cli *cli, const struct cli_cmd *cmd)
+{
+	return 0 == cmd->roles || (cmd->roles & cli->current_user->roles);
+}
+#endif
+
+// command matches the prefix and the current user can see it
+STATIC bool cli_cmd_match(struct cli *cli, const struct cli_cmd *cmd,
+			  const char *prefix, size_t len)
+{
+#ifdef ENABLE_ROLES
+	if (!cli_cmd_visible(cli, cmd))
+	{
+		return false;
+	}
+#else
+	(void) cli;
+#endif
+	return cli_cmd_name_starts_with(cmd, prefix, len);
+}
+
+#ifdef ENABLE_COMMAND_INDEX
+// When the index is valid, commands are searched in two sorted arrays:
+// common index (common and static commands) and the user index.
+// All the commands starting with the same prefix are stored one after
+// another starting at the lower bound
+STATIC struct cli_cmd_index *cli_index_get(struct cli *cli, uint8_t src)
+{
+	return (CLI_CMD_SRC_USER == src) ? 
+		&cli->current_user->index : &cli->reg->common_index;
+}
+
+STATIC const struct cli_cmd *cli_index_match(struct cli *cli,
+					     struct cli_cmd_iter *it,
+					     const char *prefix, size_t len)
+{
+	for (;;)
+	{
+		struct cli_cmd_index *idx = cli_index_get(cli, it->src);
+#ifdef ENABLE_ROLES
+		// commands hidden from the user are skipped
+		for (; idx->cnt > it->pos 
+			     && !cli_cmd_visible(cli, idx->cmds[it->pos]);
+		     it->pos++);
+#endif
+		if (idx->cnt > it->pos 
+		    && cli_cmd_name_starts_with(idx->cmds[it->pos],
+						prefix, len))
+		{
+			it->cmd = idx->cmds[it->pos];
+			break;
+		}
+
+		if (CLI_CMD_SRC_USER == it->src)
+		{
+			it->cmd = NULL;
+			break;
+		}
+
+		// no more matches in common index, continue in user index
+		it->src = CLI_CMD_SRC_USER;
+		it->pos = cli_index_lower_bound(
+			cli_index_get(cli, it->src), prefix, len);
+	}
+	return it->cmd;
+}
+#endif
+
+// finds the next command starting with the first len characters
+// of prefix, after the one it points to
+STATIC const struct cli_cmd *cli_match_next(struct cli *cli,
+					    struct cli_cmd_iter *it,
+					    const char *prefix, size_t len)
+{
+#ifdef ENABLE_COMMAND_INDEX
+	if (cli->reg->index_valid)
+	{
+		it->pos += 1;
+		return cli_index_match(cli, it, prefix, len);
+	}
+#endif
+
+	const struct cli_cmd *cmd = cli_cmd_iter_next(cli, it);
+	for (; NULL != cmd && !cli_cmd_match(cli, cmd, prefix, len);
+	     cmd = cli_cmd_iter_next(cli, it));
+	return cmd;
+}
+
+// finds the first command starting with the first len characters
+// of prefix. With len 0 all the commands are matched
+STATIC const struct cli_cmd *cli_match_first(struct cli *cli,
+					     struct cli_cmd_iter *it,
+					     const char *prefix, size_t len)
+{
+#ifdef ENABLE_COMMAND_INDEX
+	if (cli->reg->index_valid)
+	{
+		it->src = CLI_CMD_SRC_COMMON;
+		it->pos = cli_index_lower_bound(
+			cli_index_get(cli, it->src), prefix, len);
+		return cli_index_match(cli, it, prefix, len);
+	}
+#endif
+
+	const struct cli_cmd *cmd = cli_cmd_iter_first(cli, it);
+	if (cli_cmd_match(cli, cmd, prefix, len))
+	{
+		return cmd;
+	}
+	return cli_match_next(cli, it, prefix, len);
+}
+
+#ifdef ENABLE_PERFECT_HASH
+// searches the commands of one source for the one named with the
+// first len characters of name
+STATIC const struct cli_cmd *cli_search_src(struct cli *cli, uint8_t src,
+					    const char *name, size_t len)
+{
+	struct cli_cmd_iter it;
+	it.src = src;
+	it.cmd = cli_cmd_iter_src_first(cli, src);
+
+	// iterator continues in the next source after the last command
+	for (; NULL != it.cmd && src == it.src; cli_cmd_iter_next(cli, &it))
+	{
+		if (cli_cmd_match(cli, it.cmd, name, len)
+		    && '\0' == it.cmd->command_name[len])
+		{
+			return it.cmd;
+		}
+	}
+	return NULL;
+}
+
+// Same order as the linear search: common, static and user commands.
+// Static commands are found with the hash only. If the table doesnt
+// have all of them (not all the files were given to the generator),
+// the static section is searched on a miss
+STATIC const struct cli_cmd *cli_phash_search_all(struct cli *cli,
+						  const char *name,
+						  size_t len)
+{
+	const struct cli_cmd *cmd = 
+		cli_search_src(cli, CLI_CMD_SRC_COMMON, name, len);
+	if (NULL != cmd)
+	{
+		return cmd;
+	}
+
+	cmd = cli_phash_search(name, len);
+	if (NULL == cmd && CLI_PHASH_CMD_CNT 
+	    != (size_t) (STATIC_CMDS_END - STATIC_CMDS_START))
+	{
+		cmd = cli_search_src(cli, CLI_CMD_SRC_STATIC, name, len);
+	}
+	else if (NULL != cmd && !cli_cmd_match(cli, cmd, name, len))
+	{
+		// hidden from the user
+		cmd = NULL;
+	}
+	return cmd ? cmd : cli_search_src(cli, CLI_CMD_SRC_USER, name, len);
+}
+#endif
+
+// searches for the command, which name is equal to the first word
+// of the input
+STATIC const struct cli_cmd *cli_search_command(struct cli *cli, 
+						const char *input)
+{
+	size_t len = strcspn(input, " ");
+	struct cli_cmd_iter it;
+
+#ifdef ENABLE_PERFECT_HASH
+#ifdef ENABLE_COMMAND_INDEX
+	if (!cli->reg->index_valid)
+#endif
+	{
+		return cli_phash_search_all(cli, input, len);
+	}
+#endif
+
+	for (const struct cli_cmd *cmd = cli_match_first(cli, &it, 
+							 input, len);
+	     NULL != cmd; cmd = cli_match_next(cli, &it, input, len))
+	{
+		if ('\0' == cmd->command_name[len])
+		{
+			return cmd;
+		}
+	}
+        return NULL;
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+// searches the subcommands of group for the one named with the first
+// len characters of name
+STATIC const struct cli_cmd *cli_subcmd_search(const struct cli_cmd *group,
+					       const char *name, size_t len)
+{
+	for (uint32_t i = 0; group->subcmd_cnt > i; i++)
+	{
+		const struct cli_cmd *cmd = &group->subcmds[i];
+		if (cli_cmd_name_starts_with(cmd, name, len)
+		    && '\0' == cmd->command_name[len])
+		{
+			return cmd;
+		}
+	}
+	return NULL;
+}
+
+// returns the word after the one input points to
+STATIC char *cli_next_word(char *input)
+{
+	input += strcspn(input, " ");
+	return input + strspn(input, " ");
+}
+
+// Descends from cmd through the subcommand tables, one word of the
+// input per level. Returns the deepest command found, *input is moved
+// to its name and *depth is increased by the number of levels
+STATIC const struct cli_cmd *cli_subcmd_descend(const struct cli_cmd *cmd,
+						char **input, 
+						uint32_t *depth)
+{
+	while (cmd->subcmd_cnt)
+	{
+		char *next = cli_next_word(*input);
+		const struct cli_cmd *sub = 
+			cli_subcmd_search(cmd, next, strcspn(next, " "));
+		if (NULL == sub)
+		{
+			break;
+		}
+		cmd = sub;
+		*input = next;
+		*depth += 1;
+	}
+	return cmd;
+}
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+STATIC struct cli_cmd_stats *cli_stats_new(struct cli_registry *reg)
+{
+	struct cli_cmd_stats *st = reg->malloc(sizeof(struct cli_cmd_stats));
+	memset(st, 0, sizeof(struct cli_cmd_stats));
+	return st;
+}
+#endif
+
+// Commands are allocated in one block and linked in the array order.
+// Their stats are placed after them in the same block
+STATIC struct cli_cmd *cli_make_new_cmds(struct cli_registry *reg, 
+					 const struct cli_cmd_settings *cs,
+					 size_t n)
+{
+	size_t size = n * sizeof(struct cli_cmd);
+#ifdef ENABLE_COMMAND_STATS
+	size += n * sizeof(struct cli_cmd_stats);
+#endif
+	struct cli_cmd *cmds = reg->malloc(size);
+	if (NULL == cmds)
+	{
+		return NULL;
+	}
+
+#ifdef ENABLE_COMMAND_STATS
+	struct cli_cmd_stats *st = (struct cli_cmd_stats *) &cmds[n];
+	memset(st, 0, n * sizeof(struct cli_cmd_stats));
+#endif
+	for (size_t i = 0; n > i; i++)
+	{
+		struct cli_cmd *tmp = &cmds[i];
+		tmp->next = (n > i + 1) ? &cmds[i + 1] : NULL;
+		tmp->command_name = cs[i].command_name;
+		tmp->command_description = cs[i].command_description;
+		tmp->command_function = cs[i].command_function;
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		tmp->command_step = cs[i].command_step;
+#endif
+#ifdef ENABLE_ARGUMENT_SCHEMA
+		tmp->args = cs[i].args;
+		tmp->arg_cnt = cs[i].arg_cnt;
+#endif
+#ifdef ENABLE_ROLES
+		tmp->roles = cs[i].roles;
+#endif
+#ifdef ENABLE_SUBCOMMANDS
+		tmp->subcmds = cs[i].subcmds;
+		tmp->subcmd_cnt = cs[i].subcmd_cnt;
+#endif
+#ifdef ENABLE_COMMAND_STATS
+		tmp->stats = &st[i];
+#endif
+	}
+	return cmds;
+}
+
+bool cli_add_cmds(struct cli *cli, const struct cli_cmd_settings *cs,
+		  size_t n)
+{
+	if (NULL == cli || (NULL == cs && 0 != n))
+	{
+		return false;
+	}
+	if (0 == n)
+	{
+		return true;
+	}
+
+	struct cli_cmd *new = cli_make_new_cmds(cli->reg, cs, n);
+	if (NULL == new)
+	{
+		return false;
+	}
+
+	cli->reg->common_tail->next = new;
+	cli->reg->common_tail = &new[n - 1];
+
+#ifdef ENABLE_COMMAND_INDEX
+	cli->reg->index_valid = false;
+#endif
+
+	return true;
+}
+
+bool cli_add_cmd_common(struct cli *cli, struct cli_cmd_settings cs)
+{
+	return cli_add_cmds(cli, &cs, 1);
+}
+
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+// false if the command doesnt come from the user typing in a terminal
+STATIC bool cli_is_interactive(struct cli *cli)
+{
+	(void) cli;
+#ifdef ENABLE_SCRIPT
+	if (cli->in_script)
+	{
+		return false;
+	}
+#endif
+#ifdef ENABLE_MACHINE_MODE
+	if (cli->mm_enabled)
+	{
+		return false;
+	}
+#endif
+	return true;
+}
+#endif
+
+STATIC void cli_command_received_handler(struct cli *cli, char *input)
+{
+	const struct cli_cmd *tmp_command = 
+		cli_search_command(cli, input);
+
+	if (tmp_command)
+	{
+		// command is called with its part of the input
+		char *cmd_input = input;
+#ifdef ENABLE_SUBCOMMANDS
+		uint32_t depth = 0;
+		tmp_command = cli_subcmd_descend(tmp_command, &cmd_input, 
+						 &depth);
+#endif
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+		if (cli_is_interactive(cli))
+		{
+			cli_history_save_cmd(cli, input);
+		}
+#endif
+
+#ifdef ENABLE_SUBCOMMANDS
+		if (NULL == tmp_command->command_function
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		    && NULL == tmp_command->command_step
+#endif
+		    )
+		{
+			// group without a function lists its level, 
+			// unknown subcommand is an error
+#ifdef ENABLE_COMMAND_STATUS
+			if ('\0' != *cli_next_word(cmd_input))
+			{
+				cli->status = CLI_STATUS_UNKNOWN_CMD;
+			}
+#endif
+			cli_subcmd_help(cli, tmp_command);
+			return;
+		}
+#endif
+
+#ifdef ENABLE_ARGUMENT_PARSER
+		const char *args_error = cli_argumument_parser_reset(cli);
+		if (args_error)
+		{
+			echo_string(cli, args_error);
+			echo_input_end_sequence(cli);
+#ifdef ENABLE_COMMAND_STATUS
+			cli->status = CLI_STATUS_BAD_ARGS;
+#endif
+			return;
+		}
+#ifdef ENABLE_SUBCOMMANDS
+		cli_argument_parser_shift(cli, depth);
+#endif
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+		if (tmp_command->args && !cli_args_parse(cli, tmp_command))
+		{
+#ifdef ENABLE_COMMAND_STATUS
+			cli->status = CLI_STATUS_BAD_ARGS;
+#endif
+			return;
+		}
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+		// command can send data directly, so the echo must 
+		// be sent before
+		cli_output_flush(cli);
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+		uint32_t (*get_timestamp)(void) = cli->reg->get_timestamp;
+		uint32_t start = get_timestamp ? get_timestamp() : 0;
+#endif
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		if (tmp_command->command_step)
+		{
+			cli->cmd_step = 0;
+			if (tmp_command->command_step(cli, cmd_input, 0))
+			{
+				// next steps get the same part of the input
+				cli->running_cmd = tmp_command;
+				cli->cmd_input = cmd_input;
+			}
+		}
+		else
+#endif
+		{
+			tmp_command->command_function(cli, cmd_input);
+		}
+
+#ifdef ENABLE_COMMAND_STATS
+		uint32_t time = get_timestamp ? get_timestamp() - start : 0;
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		if (cli->running_cmd)
+		{
+			// call is recorded once, when its last step is done
+			cli->cmd_time = time;
+		}
+		else
+#endif
+		{
+			cli_stats_record(tmp_command->stats, time);
+		}
+#endif
+	}
+#ifdef ENABLE_COMMAND_STATUS
+	else
+	{
+		cli->status = CLI_STATUS_UNKNOWN_CMD;
+	}
+#endif
+}
+
+// complete input line is passed to the handler requested by a command
+// or searched for a command
+STATIC void cli_input_line_handler(struct cli *cli, char *input)
+{
+#ifdef ENABLE_COMMAND_STATUS
+	cli->status = CLI_STATUS_OK;
+#endif
+
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	if (cli->input_handler)
+	{
+		// input was requested by a command, pass it to its
+		// handler instead of searching for a command. Handler
+		// can request more input
+		void (*handler)(struct cli *cli, char *input) = 
+			cli->input_handler;
+		cli->input_handler = NULL;
+		cli->input_hide = false;
+		handler(cli, input);
+		return;
+	}
+#endif
+	cli_command_received_handler(cli, input);
+}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+// called when the running command has no more work
+STATIC void cli_command_finish(struct cli *cli)
+{
+#ifdef ENABLE_COMMAND_STATS
+	cli_stats_record(cli->running_cmd->stats, cli->cmd_time);
+#endif
+	cli->running_cmd = NULL;
+
+#ifdef ENABLE_MACHINE_MODE
+	if (cli->mm_enabled)
+	{
+		cli_machine_request_end(cli, cli->status);
+		return;
+	}
+#endif
+#ifdef ENABLE_SCRIPT
+	if (cli->in_script)
+	{
+		return;
+	}
+#endif
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	if (NULL == cli->input_handler)
+#endif
+	{
+		echo_string(cli, cli->current_user->prompt);
+	}
+}
+
+STATIC void cli_command_step(struct cli *cli)
+{
+	const struct cli_cmd *cmd = cli->running_cmd;
+	cli->cmd_step += 1;
+
+#ifdef ENABLE_COMMAND_STATS
+	uint32_t (*get_timestamp)(void) = cli->reg->get_timestamp;
+	uint32_t start = get_timestamp ? get_timestamp() : 0;
+#endif
+	bool more = cmd->command_step(cli, cli->cmd_input, cli->cmd_step);
+#ifdef ENABLE_COMMAND_STATS
+	cli->cmd_time += get_timestamp ? get_timestamp() - start : 0;
+#endif
+
+	if (!more)
+	{
+		cli_command_finish(cli);
+	}
+}
+
+STATIC void cli_command_cancel(struct cli *cli)
+{
+	echo_string(cli, "^C\r\n");
+#ifdef ENABLE_COMMAND_STATS
+	uint32_t (*get_timestamp)(void) = cli->reg->get_timestamp;
+	uint32_t start = get_timestamp ? get_timestamp() : 0;
+#endif
+	cli->running_cmd->command_step(cli, cli->cmd_input, 
+				       CLI_STEP_CANCEL);
+#ifdef ENABLE_COMMAND_STATS
+	cli->cmd_time += get_timestamp ? get_timestamp() - start : 0;
+#endif
+#ifdef ENABLE_COMMAND_STATUS
+	cli->status = CLI_STATUS_CANCELLED;
+#endif
+	cli_command_finish(cli);
+}
+
+// while a command runs in machine mode the input is left unread, 
+// so the next requests wait for it
+STATIC bool cli_input_blocked(struct cli *cli)
+{
+	(void) cli;
+#ifdef ENABLE_MACHINE_MODE
+	return cli->mm_enabled && cli->running_cmd;
+#else
+	return false;
+#endif
+}
+#endif
+
+#ifdef ENABLE_COMMAND_STATUS
+void cli_set_status(struct cli *cli, int32_t status)
+{
+	cli->status = status;
+}
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+enum cli_machine_state {
+	CLI_MM_SOF,
+	CLI_MM_TYPE,
+	CLI_MM_SEQ,
+	CLI_MM_LEN,
+	CLI_MM_PAYLOAD,
+	CLI_MM_CRC_HI,
+	CLI_MM_CRC_LO,
+};
+
+void cli_machine_mode(struct cli *cli, bool enable)
+{
+	cli->mm_enabled = enable;
+	cli->mm_state = CLI_MM_SOF;
+	cli->input_buff_index = 0;
+	cli->input_buff[0] = '\0';
+#ifdef ENABLE_LINE_EDITING
+	cli->input_tail = 0;
+#endif
+}
+
+STATIC void cli_machine_request(struct cli *cli, int32_t status)
+{
+	cli->mm_busy = true;
+	cli->mm_out_len = 0;
+
+	if (CLI_STATUS_OK == status)
+	{
+		cli->input_buff[cli->mm_len] = '\0';
+		cli_input_line_handler(cli, cli->input_buff);
+		status = cli->status;
+	}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	if (cli->running_cmd)
+	{
+		// END frame is sent when the command finishes
+		return;
+	}
+#endif
+	cli_machine_request_end(cli, status);
+}
+
+STATIC void cli_machine_request_end(struct cli *cli, int32_t status)
+{
+	cli_machine_send_data(cli);
+	cli->mm_busy = false;
+
+	char st[4] = {(char) status, (char) (status >> 8), 
+		      (char) (status >> 16), (char) (status >> 24)};
+	cli_machine_send_frame(cli, CLI_FRAME_END, st, sizeof(st));
+	cli->input_buff_index = 0;
+}
+
+// Receives a request frame one byte at a time. Payload bytes which
+// dont fit the command buffer are dropped, but the frame is still 
+// received to the end, so the next frame starts in sync
+STATIC void cli_machine_rx(struct cli *cli, uint8_t c)
+{
+	if (CLI_MM_CRC_HI > cli->mm_state)
+	{
+		cli->mm_crc = cli_crc16(cli->mm_crc, c);
+	}
+
+	switch (cli->mm_state)
+	{
+	case CLI_MM_SOF:
+		if (CLI_FRAME_SOF == c)
+		{
+			cli->mm_crc = 0xffff;
+			cli->mm_state = CLI_MM_TYPE;
+		}
+		break;
+	case CLI_MM_TYPE:
+		cli->mm_type = c;
+		cli->mm_state = CLI_MM_SEQ;
+		break;
+	case CLI_MM_SEQ:
+		cli->mm_seq = c;
+		cli->mm_state = CLI_MM_LEN;
+		break;
+	case CLI_MM_LEN:
+		cli->mm_len = c;
+		cli->mm_index = 0;
+		cli->mm_state = c ? CLI_MM_PAYLOAD : CLI_MM_CRC_HI;
+		break;
+	case CLI_MM_PAYLOAD:
+		if (CLI_COMMAND_BUFF_SIZE - 1 > cli->mm_index)
+		{
+			cli->input_buff[cli->mm_index] = (char) c;
+		}
+		cli->mm_index += 1;
+		if (cli->mm_len == cli->mm_index)
+		{
+			cli->mm_state = CLI_MM_CRC_HI;
+		}
+		break;
+	case CLI_MM_CRC_HI:
+		cli->mm_crc ^= (uint16_t) (c << 8);
+		cli->mm_state = CLI_MM_CRC_LO;
+		break;
+	default:
+		cli->mm_crc ^= c;
+		cli->mm_state = CLI_MM_SOF;
+
+		if (0 != cli->mm_crc || CLI_FRAME_CMD != cli->mm_type)
+		{
+			cli_machine_request(cli, CLI_STATUS_BAD_FRAME);
+		}
+		else if (CLI_COMMAND_BUFF_SIZE <= cli->mm_len)
+		{
+			cli_machine_request(cli, CLI_STATUS_TOO_LONG);
+		}
+		else
+		{
+			cli_machine_request(cli, CLI_STATUS_OK);
+		}
+		break;
+	}
+}
+#endif
+
+#ifdef ENABLE_SCRIPT
+STATIC bool cli_script_is_space(char c)
+{
+	return ' ' == c || '\t' == c || '\r' == c;
+}
+
+// runs one script line, returns its status
+STATIC int32_t cli_script_line(struct cli *cli, const char *line, 
+			       size_t len)
+{
+	if (CLI_COMMAND_BUFF_SIZE <= len)
+	{
+		return CLI_STATUS_TOO_LONG;
+	}
+
+	// line is copied in the input buffer, so the argument parser
+	// works as with typed commands
+	memcpy(cli->input_buff, line, len);
+	cli->input_buff[len] = '\0';
+	cli_input_line_handler(cli, cli->input_buff);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	// script lines run one after another, so the steps are not
+	// spread over cli_run calls
+	while (cli->running_cmd)
+	{
+		cli_command_step(cli);
+	}
+#endif
+	return cli->status;
+}
+
+bool cli_exec_script(struct cli *cli, const char *buf, size_t len,
+		     bool stop_on_error, struct cli_script_result *result)
+{
+	struct cli_script_result r = {0, 0, 0, 0};
+	uint32_t line_num = 0;
+
+	if (NULL == cli || NULL == buf)
+	{
+		return false;
+	}
+
+	// interactive input is kept and restored when the script ends
+	char input_buff[CLI_COMMAND_BUFF_SIZE];
+	size_t input_buff_index = cli->input_buff_index;
+	memcpy(input_buff, cli->input_buff, sizeof(input_buff));
+#ifdef ENABLE_LINE_EDITING
+	size_t input_tail = cli->input_tail;
+#endif
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	void (*input_handler)(struct cli *cli, char *input) = 
+		cli->input_handler;
+	bool input_hide = cli->input_hide;
+	cli->input_handler = NULL;
+	cli->input_hide = false;
+#endif
+	cli->in_script = true;
+
+	for (size_t i = 0; len > i; i++)
+	{
+		const char *end = memchr(&buf[i], '\n', len - i);
+		size_t line_end = end ? (size_t) (end - buf) : len;
+
+		line_num += 1;
+		for (; line_end > i && cli_script_is_space(buf[i]); i++);
+
+		size_t line_len = line_end - i;
+		for (; line_len && cli_script_is_space(buf[i + line_len - 1]);
+		     line_len--);
+
+		if (line_len && '#' != buf[i])
+		{
+			int32_t status = cli_script_line(cli, &buf[i], 
+							 line_len);
+			r.executed += 1;
+			if (CLI_STATUS_OK != status)
+			{
+				if (0 == r.failed)
+				{
+					r.error_line = line_num;
+					r.error_status = status;
+				}
+				r.failed += 1;
+				if (stop_on_error)
+				{
+					break;
+				}
+			}
+		}
+		i = line_end;
+	}
+
+	cli->in_script = false;
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	cli->input_handler = input_handler;
+	cli->input_hide = input_hide;
+#endif
+	memcpy(cli->input_buff, input_buff, sizeof(input_buff));
+	cli->input_buff_index = input_buff_index;
+#ifdef ENABLE_LINE_EDITING
+	cli->input_tail = input_tail;
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+	cli_output_flush(cli);
+#endif
+
+	if (result)
+	{
+		*result = r;
+	}
+	return 0 == r.failed;
+}
+#endif
+
+#ifdef ENABLE_LINE_EDITING
+// Terminal cursor is moved with backspaces, by echoing the characters
+// again or with escape sequences, whichever is shorter. Insert and
+// delete in the middle of the line use ICH/DCH sequences unless 
+// redrawing the rest of the line is shorter
+
+// bytes needed for ESC [ n x
+STATIC size_t cli_csi_len(size_t n)
+{
+	size_t len = 3;
+	if (1 == n)
+	{
+		return len;
+	}
+	for (; n; n /= 10)
+	{
+		len++;
+	}
+	return len;
+}
+
+// sends ESC [ n x, n is left out if it is 1
+STATIC void cli_echo_csi(struct cli *cli, size_t n, char x)
+{
+	char b[24];
+	size_t i = sizeof(b);
+
+	b[--i] = x;
+	if (1 != n)
+	{
+		do
+		{
+			b[--i] = (char) ('0' + (n % 10));
+			n /= 10;
+		} while (n);
+	}
+	b[--i] = '[';
+	b[--i] = 0x1b;
+	cli_output(cli, &b[i], sizeof(b) - i);
+}
+
+// moves the cursor to pos in the input
+STATIC void cli_cursor_move(struct cli *cli, size_t pos)
+{
+	size_t cur = cli->input_buff_index - cli->input_tail;
+
+	if (pos < cur)
+	{
+		size_t n = cur - pos;
+		if (n < cli_csi_len(n))
+		{
+			for (size_t i = 0; n > i; i++)
+			{
+				cli_send_char(cli, '\b');
+			}
+		}
+		else
+		{
+			cli_echo_csi(cli, n, 'D');
+		}
+	}
+	else if (pos > cur)
+	{
+		size_t n = pos - cur;
+		if (n <= cli_csi_len(n))
+		{
+			cli_output(cli, &cli->input_buff[cur], n);
+		}
+		else
+		{
+			cli_echo_csi(cli, n, 'C');
+		}
+	}
+	cli->input_tail = cli->input_buff_index - pos;
+}
+
+STATIC void cli_edit_insert(struct cli *cli, char c)
+{
+	size_t tail = cli->input_tail;
+	size_t cur = cli->input_buff_index - tail;
+
+	if (CLI_COMMAND_BUFF_SIZE <= cli->input_buff_index + 1)
+	{
+		return;
+	}
+
+	memmove(&cli->input_buff[cur + 1], &cli->input_buff[cur], tail);
+	cli->input_buff[cur] = c;
+	cli->input_buff_index += 1;
+	cli->input_buff[cli->input_buff_index] = '\0';
+
+	// ICH + character or the rest of the line and back
+	if (4 < 1 + 2 * tail)
+	{
+		cli_echo_csi(cli, 1, '@');
+		cli_send_char(cli, c);
+	}
+	else
+	{
+		cli_output(cli, &cli->input_buff[cur], tail + 1);
+		for (size_t i = 0; tail > i; i++)
+		{
+			cli_send_char(cli, '\b');
+		}
+	}
+}
+
+// deletes the character under the cursor
+STATIC void cli_edit_delete(struct cli *cli)
+{
+	size_t tail = cli->input_tail;
+	size_t cur = cli->input_buff_index - tail;
+
+	if (0 == tail)
+	{
+		return;
+	}
+
+	memmove(&cli->input_buff[cur], &cli->input_buff[cur + 1], tail - 1);
+	cli->input_buff_index -= 1;
+	cli->input_buff[cli->input_buff_index] = '\0';
+	cli->input_tail -= 1;
+
+	// DCH or the rest of the line, space over the last character 
+	// and back
+	if (3 < 2 * tail)
+	{
+		cli_echo_csi(cli, 1, 'P');
+	}
+	else
+	{
+		cli_output(cli, &cli->input_buff[cur], tail - 1);
+		cli_send_char(cli, ' ');
+		for (size_t i = 0; tail > i; i++)
+		{
+			cli_send_char(cli, '\b');
+		}
+	}
+}
+
+STATIC void cli_edit_backspace(struct cli *cli)
+{
+	if (0 == cli->input_tail)
+	{
+		delete_last_echoed_char(cli);
+	}
+	else if (cli->input_buff_index > cli->input_tail)
+	{
+		cli_cursor_move(cli, cli->input_buff_index 
+				- cli->input_tail - 1);
+		cli_edit_delete(cli);
+	}
+}
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+// Replaces the input with s. Only the part after the common prefix
+// is sent, rest of the old line is cleared with EL
+STATIC void cli_line_replace(struct cli *cli, const char *s, size_t len)
+{
+	size_t old_len = cli->input_buff_index;
+	size_t p = 0;
+
+	for (; len > p && old_len > p && cli->input_buff[p] == s[p]; p++);
+
+	cli_cursor_move(cli, p);
+	cli_output(cli, &s[p], len - p);
+	memcpy(&cli->input_buff[p], &s[p], len - p);
+	cli->input_buff[len] = '\0';
+	cli->input_buff_index = len;
+	cli->input_tail = 0;
+
+	if (old_len > len)
+	{
+		size_t n = old_len - len;
+		if (1 == n)
+		{
+			cli_send_char(cli, ' ');
+			cli_send_char(cli, '\b');
+		}
+		else
+		{
+			cli_echo_csi(cli, 1, 'K');
+		}
+	}
+}
+#endif
+#endif
+
+STATIC char *cli_handle_new_character(struct cli *cli, char c,
+				      bool hide_echo)
+{
+	char *ret = NULL;
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	// input is ignored while a command runs, Ctrl-C cancels it
+	if (cli->running_cmd)
+	{
+		if (0x03 == c)
+		{
+			cli_command_cancel(cli);
+		}
+		return NULL;
+	}
+
+	if (0x03 == c)
+	{
+		// Ctrl-C on the prompt drops the current line and the
+		// input requested by a command, like a pending su password
+		cli->input_buff_index = 0;
+		cli->input_buff[0] = '\0';
+#ifdef ENABLE_LINE_EDITING
+		cli->input_tail = 0;
+#endif
+#if defined(ENABLE_USER_INPUT_REQUEST)
+		cli->input_handler = NULL;
+		cli->input_hide = false;
+#endif
+#ifdef ENABLE_USER_MANAGEMENT
+		cli->su_user = NULL;
+#endif
+		echo_string(cli, "^C\r\n");
+		echo_string(cli, cli->current_user->prompt);
+		return NULL;
+	}
+#endif
+
+#if defined(ENABLE_AUTOCOMPLETE)
+	// autocomplete candidates are cached only between tabs
+	if ('\t' != c)
+	{
+		cli->ac_valid = false;
+	}
+#endif
+
+        if (cli->input_end_char == c)
+	{
+		cli->input_buff[cli->input_buff_index] = '\0';
+
+#ifdef ENABLE_HISTORY_V1
+		if (!hide_echo && cli_history_handler_input_v1(cli))
+		{
+			ret = NULL;
+		}
+		else
+#endif
+		{
+			ret = cli->input_buff;
+			echo_input_end_sequence(cli);
+			cli->input_buff_index = 0;
+#ifdef ENABLE_LINE_EDITING
+			cli->input_tail = 0;
+#endif
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+			cli->history_pos = 0;
+#endif
+		}
+
+		cli->special_sequence = false;
+		cli->ssb_index = 0;
+        }
+        else if( '\b' == c || 0x7f == c) //backspace
+        {
+#ifdef ENABLE_LINE_EDITING
+		cli_edit_backspace(cli);
+#else
+		delete_last_echoed_char(cli);
+#endif
+        }
+        else if( '\r' == c) //drop character
+        {
+                //TODO: Maybe there is a need for droping more than
+		// one character?
+        }
+#if defined(ENABLE_AUTOCOMPLETE)
+        else if( '\t' == c) //tab
+        {
+		if (!hide_echo)
+		{
+#ifdef ENABLE_LINE_EDITING
+			// command name is completed at the end of the line
+			cli_cursor_move(cli, cli->input_buff_index);
+#endif
+			cli_autocomplete(cli);
+		}
+		return ret;
+        }
+#endif
+#if defined(ENABLE_HISTORY_V2) || defined(ENABLE_LINE_EDITING)
+	else if (cli_special_sequence_handler(cli, c, hide_echo))
+	{
+
+	}
+#endif
+#ifdef ENABLE_LINE_EDITING
+	else if (cli->input_tail && !hide_echo)
+	{
+		cli_edit_insert(cli, c);
+	}
+#endif
+        else if ((cli->input_buff_index + 1) < CLI_COMMAND_BUFF_SIZE)
+        {
+                cli->input_buff[cli->input_buff_index] = c;
+                cli->input_buff_index += 1;
+
+		if (hide_echo)
+		{
+			cli_send_char(cli, '*');
+		}
+		else
+		{
+			cli_send_char(cli, c);
+		}
+        }
+	return ret;
+}
+
+
+STATIC void cli_handle_input_char(struct cli *cli, char c)
+{
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+	cli_reset_logout_timer(cli);
+#endif
+#ifdef ENABLE_MACHINE_MODE
+	if (cli->mm_enabled)
+	{
+		cli_machine_rx(cli, (uint8_t) c);
+		return;
+	}
+#endif
+	bool hide_echo = false;
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	hide_echo = cli->input_hide;
+#endif
+	char *input_received = 
+		cli_handle_new_character(cli, c, hide_echo);
+	if (input_received)
+	{
+		cli_input_line_handler(cli, input_received);
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		// prompt is printed when the command finishes
+		if (cli->running_cmd)
+		{
+			return;
+		}
+#endif
+#if defined(ENABLE_USER_INPUT_REQUEST)
+		if (NULL == cli->input_handler)
+#endif
+		{
+			echo_string(cli, cli->current_user->prompt);
+		}
+	}
+}
+
+#ifdef ENABLE_ISR_INPUT
+// Lock free ring for one producer (ISR) and one consumer (cli_run).
+// Head and tail are free running, only the producer writes head and
+// only the consumer writes tail. Data is written before head is 
+// released, so the consumer never sees a position before its data
+
+bool cli_push_char_from_isr(struct cli *cli, char c)
+{
+	uint32_t head = cli->rx_head;
+	uint32_t tail = __atomic_load_n(&cli->rx_tail, __ATOMIC_ACQUIRE);
+
+	if (CLI_ISR_RING_SIZE == head - tail)
+	{
+		cli->rx_overrun += 1;
+		return false;
+	}
+	cli->rx_ring[head & (CLI_ISR_RING_SIZE - 1)] = c;
+	__atomic_store_n(&cli->rx_head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+size_t cli_push_buf_from_isr(struct cli *cli, const char *buf, size_t len)
+{
+	uint32_t head = cli->rx_head;
+	uint32_t tail = __atomic_load_n(&cli->rx_tail, __ATOMIC_ACQUIRE);
+	size_t space = CLI_ISR_RING_SIZE - (head - tail);
+	size_t n = (len < space) ? len : space;
+
+	// copied in up to two parts, the second one at the start
+	size_t pos = head & (CLI_ISR_RING_SIZE - 1);
+	size_t first = CLI_ISR_RING_SIZE - pos;
+	if (first > n)
+	{
+		first = n;
+	}
+	memcpy(&cli->rx_ring[pos], buf, first);
+	memcpy(&cli->rx_ring[0], &buf[first], n - first);
+
+	cli->rx_overrun += (uint32_t) (len - n);
+	__atomic_store_n(&cli->rx_head, head + (uint32_t) n, 
+			 __ATOMIC_RELEASE);
+	return n;
+}
+
+uint32_t cli_isr_overrun_cnt(struct cli *cli)
+{
+	return cli->rx_overrun;
+}
+
+// input comes from the ring if there are no input callbacks
+STATIC bool cli_input_from_ring(struct cli *cli)
+{
+#ifdef ENABLE_BULK_INPUT
+	if (cli->get_buf)
+	{
+		return false;
+	}
+#endif
+	return NULL == cli->get_char;
+}
+
+// Returns length of the contiguous part of the ring with new input,
+// *s is set to its start. Data stays there until it is released
+STATIC size_t cli_ring_peek(struct cli *cli, const char **s)
+{
+	uint32_t tail = cli->rx_tail;
+	uint32_t head = __atomic_load_n(&cli->rx_head, __ATOMIC_ACQUIRE);
+	size_t pos = tail & (CLI_ISR_RING_SIZE - 1);
+	size_t n = head - tail;
+
+	if (n > CLI_ISR_RING_SIZE - pos)
+	{
+		n = CLI_ISR_RING_SIZE - pos;
+	}
+	*s = &cli->rx_ring[pos];
+	return n;
+}
+
+// gives n characters back to the producer
+STATIC void cli_ring_release(struct cli *cli, size_t n)
+{
+	__atomic_store_n(&cli->rx_tail, cli->rx_tail + (uint32_t) n, 
+			 __ATOMIC_RELEASE);
+}
+
+STATIC bool cli_ring_get_char(struct cli *cli, char *c)
+{
+	const char *s;
+	if (cli_ring_peek(cli, &s))
+	{
+		*c = *s;
+		cli_ring_release(cli, 1);
+		return true;
+	}
+	return false;
+}
+#endif
+
+#ifdef ENABLE_BULK_INPUT
+// input is read in chunks from get_buf or the ISR ring
+STATIC bool cli_input_chunked(struct cli *cli)
+{
+#ifdef ENABLE_ISR_INPUT
+	if (cli_input_from_ring(cli))
+	{
+		return true;
+	}
+#endif
+	return NULL != cli->get_buf;
+}
+
+STATIC bool cli_input_chunk_fill(struct cli *cli)
+{
+	if (cli->in_buff_index >= cli->in_buff_len)
+	{
+#ifdef ENABLE_ISR_INPUT
+		if (cli_input_from_ring(cli))
+		{
+			// chunks are handled in place in the ring, 
+			// processed one is released first
+			cli_ring_release(cli, cli->in_buff_len);
+			cli->in_buff_index = 0;
+			cli->in_buff_len = cli_ring_peek(cli, &cli->in_data);
+			return 0 < cli->in_buff_len;
+		}
+#endif
+		cli->in_buff_index = 0;
+		cli->in_buff_len = cli->get_buf(cli->in_buff, 
+						CLI_INPUT_CHUNK_SIZE);
+	}
+	return cli->in_buff_index < cli->in_buff_len;
+}
+
+// returns number of characters at the start of s, which only 
+// need to be added to input buffer and echoed
+STATIC size_t cli_plain_chars_len(struct cli *cli, 
+				  const char *s, size_t len)
+{
+	size_t n = 0;
+#ifdef ENABLE_MACHINE_MODE
+	if (cli->mm_enabled)
+	{
+		return 0;
+	}
+#endif
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	if (cli->running_cmd)
+	{
+		return 0;
+	}
+#endif
+#ifdef ENABLE_LINE_EDITING
+	// characters are inserted in the middle of the line one by one
+	if (cli->input_tail)
+	{
+		return 0;
+	}
+#endif
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	// hidden input is echoed char by char as *
+	if (cli->input_hide)
+	{
+		return 0;
+	}
+#endif
+	if (!cli->special_sequence)
+	{
+		for (; len > n; n++)
+		{
+			if (' ' > s[n] || 0x7f <= s[n] 
+			    || cli->input_end_char == s[n])
+			{
+				break;
+			}
+		}
+	}
+	return n;
+}
+
+STATIC void cli_handle_new_characters(struct cli *cli)
+{
+	while (cli->in_buff_index < cli->in_buff_len)
+	{
+#ifdef ENABLE_RESUMABLE_COMMANDS
+		if (cli_input_blocked(cli))
+		{
+			return;
+		}
+#endif
+		const char *s = &cli->in_data[cli->in_buff_index];
+		size_t n = cli_plain_chars_len(
+			cli, s, cli->in_buff_len - cli->in_buff_index);
+
+		if (n)
+		{
+			// whole run is added and echoed at once, 
+			// characters that dont fit are dropped
+			size_t space = CLI_COMMAND_BUFF_SIZE - 1 
+				- cli->input_buff_index;
+			size_t cnt = (n < space) ? n : space;
+
+			memcpy(&cli->input_buff[cli->input_buff_index], 
+			       s, cnt);
+			cli->input_buff_index += cnt;
+			cli_output(cli, s, cnt);
+			cli->in_buff_index += n;
+#if defined(ENABLE_AUTOCOMPLETE)
+			cli->ac_valid = false;
+#endif
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+			cli_reset_logout_timer(cli);
+#endif
+		}
+		else
+		{
+			// index is moved before handling, command
+			// could read the rest of the chunk
+			cli->in_buff_index += 1;
+			cli_handle_input_char(cli, *s);
+		}
+	}
+}
+#endif
+
+STATIC bool cli_get_char(struct cli *cli, char *c)
+{
+#ifdef ENABLE_BULK_INPUT
+	if (cli_input_chunked(cli))
+	{
+		// rest of the last chunk is used first
+		if (cli_input_chunk_fill(cli))
+		{
+			*c = cli->in_data[cli->in_buff_index];
+			cli->in_buff_index += 1;
+			return true;
+		}
+		return false;
+	}
+#endif
+#ifdef ENABLE_ISR_INPUT
+	if (cli_input_from_ring(cli))
+	{
+		return cli_ring_get_char(cli, c);
+	}
+#endif
+	return cli->get_char(c);
+}
+
+// ms until cli_run must be called again if there is no new input
+STATIC uint32_t cli_next_run_ms(struct cli *cli)
+{
+	uint32_t ms = CLI_RUN_IDLE;
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	if (cli->running_cmd)
+	{
+		// next step is due now
+		return 0;
+	}
+#endif
+
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+	if (0 != cli->logout_time_ms 
+	    && cli->current_user != GET_GUEST_USER(cli))
+	{
+		// user is logged out when the timer passes logout time
+		if (cli->logout_timer_ms > cli->logout_time_ms)
+		{
+			ms = 0;
+		}
+		else
+		{
+			ms = cli->logout_time_ms - cli->logout_timer_ms;
+			if (CLI_RUN_IDLE - 1 > ms)
+			{
+				ms += 1;
+			}
+		}
+	}
+#else
+	(void) cli;
+#endif
+	return ms;
+}
+
+uint32_t cli_run(struct cli *cli, uint32_t time_from_last_run_ms)
+{
+	(void) time_from_last_run_ms;
+
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+	cli_logout_handler(cli, time_from_last_run_ms);
+#endif
+
+	bool input_blocked = false;
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	input_blocked = cli_input_blocked(cli);
+#endif
+
+#ifdef ENABLE_BULK_INPUT
+	if (cli_input_chunked(cli))
+	{
+		while (!input_blocked && cli_input_chunk_fill(cli))
+		{
+			cli_handle_new_characters(cli);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+			input_blocked = cli_input_blocked(cli);
+#endif
+		}
+	}
+	else
+#endif
+	{
+		char c;
+		while(!input_blocked && cli_get_char(cli, &c))
+		{
+			cli_handle_input_char(cli, c);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+			input_blocked = cli_input_blocked(cli);
+#endif
+		} 
+	}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	if (cli->running_cmd
+#ifdef ENABLE_STREAMING_OUTPUT
+	    // step waits until the transport can take its output
+	    && CLI_STREAM_MIN_SPACE <= cli_output_space(cli)
+#endif
+	    )
+	{
+		cli_command_step(cli);
+	}
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+	// nothing is left in the buffer for later
+	cli_output_flush(cli);
+#endif
+	return cli_next_run_ms(cli);
+}
+
+
+STATIC void help_print_cmd(struct cli *cli, const struct cli_cmd *cmd)
+{
+	echo_string(cli, cmd->command_name);
+	echo_string(cli, "\r\n");
+	if (cmd->command_description)
+	{
+		echo_string(cli, "\t");
+		echo_string(cli, cmd->command_description);
+		echo_string(cli, "\r\n");
+	}
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+// help of one level, prints the subcommands of group
+STATIC void cli_subcmd_help(struct cli *cli, const struct cli_cmd *group)
+{
+	for (uint32_t i = 0; group->subcmd_cnt > i; i++)
+	{
+		help_print_cmd(cli, &group->subcmds[i]);
+	}
+}
+#endif
+
+STATIC void help_cmd(struct cli *cli, char *s)
+{
+        (void) s;
+
+	struct cli_cmd_iter it;
+	for (const struct cli_cmd *tmp = cli_match_first(cli, &it, "", 0);
+	     NULL != tmp; tmp = cli_match_next(cli, &it, "", 0))
+	{
+		help_print_cmd(cli, tmp);
+	}
+}
+
+#ifdef ENABLE_STREAMING_OUTPUT
+STATIC size_t help_print_len(const struct cli_cmd *cmd)
+{
+	size_t len = strlen(cmd->command_name) + 2;
+	if (cmd->command_description)
+	{
+		len += strlen(cmd->command_description) + 3;
+	}
+	return len;
+}
+
+// help as a resumable command, each step prints the commands which
+// fit in the transport space. If all of them fit, help is done in
+// step 0 as without streaming
+STATIC bool help_step(struct cli *cli, char *s, uint32_t step)
+{
+	(void) s;
+	struct cli_cmd_iter *it = &cli->stream_it;
+
+	if (CLI_STEP_CANCEL == step)
+	{
+		return false;
+	}
+
+	const struct cli_cmd *cmd = (0 == step) 
+		? cli_match_first(cli, it, "", 0) : it->cmd;
+	size_t space = cli_output_space(cli);
+	// later steps print at least one command, so a command longer
+	// than the space doesnt stop the help
+	bool force = 0 != step;
+	for (; NULL != cmd && (force || help_print_len(cmd) <= space);
+	     cmd = cli_match_next(cli, it, "", 0))
+	{
+		size_t len = help_print_len(cmd);
+		help_print_cmd(cli, cmd);
+		space = (space > len) ? space - len : 0;
+		force = false;
+	}
+	return NULL != cmd;
+}
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+STATIC void echo_uint(struct cli *cli, uint32_t n)
+{
+	char b[10];
+	size_t i = sizeof(b);
+	do
+	{
+		i -= 1;
+		b[i] = (char) ('0' + (n % 10));
+		n /= 10;
+	} while (n);
+	cli_output(cli, &b[i], sizeof(b) - i);
+}
+
+STATIC void cli_stats_record(struct cli_cmd_stats *st, uint32_t time)
+{
+	// subcommands in tables written without CLI_SUBCOMMAND have none
+	if (NULL == st)
+	{
+		return;
+	}
+	if (UINT32_MAX > st->calls)
+	{
+		st->calls += 1;
+	}
+
+	uint32_t b = 0;
+	for (uint32_t t = time; 0 != t && (CLI_STATS_HIST_SIZE - 1) > b; 
+	     t >>= 1)
+	{
+		b++;
+	}
+
+	if (UINT16_MAX > st->time_hist[b])
+	{
+		st->time_hist[b] += 1;
+	}
+	if (st->max_time < time)
+	{
+		st->max_time = time;
+	}
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+// names of the groups above a subcommand, innermost first
+struct cli_cmd_path {
+	const struct cli_cmd_path *up;
+	const char *name;
+};
+
+STATIC void stats_print_path(struct cli *cli, const struct cli_cmd_path *p)
+{
+	if (p)
+	{
+		stats_print_path(cli, p->up);
+		echo_string(cli, p->name);
+		echo_string(cli, " ");
+	}
+}
+#endif
+
+STATIC void stats_print_cmd(struct cli *cli, const struct cli_cmd *cmd)
+{
+	const struct cli_cmd_stats *st = cmd->stats;
+	if (NULL == st || 0 == st->calls)
+	{
+		return;
+	}
+
+	echo_string(cli, cmd->command_name);
+	echo_string(cli, ": ");
+	echo_uint(cli, st->calls);
+	echo_string(cli, " calls, max ");
+	echo_uint(cli, st->max_time);
+	echo_string(cli, "\r\n\t");
+	for (uint32_t b = 0; CLI_STATS_HIST_SIZE > b; b++)
+	{
+		if (st->time_hist[b])
+		{
+			if ((CLI_STATS_HIST_SIZE - 1) == b)
+			{
+				echo_string(cli, ">=");
+				echo_uint(cli, 1u << (b - 1));
+			}
+			else
+			{
+				echo_string(cli, "<");
+				echo_uint(cli, 1u << b);
+			}
+			echo_string(cli, ":");
+			echo_uint(cli, st->time_hist[b]);
+			echo_string(cli, " ");
+		}
+	}
+	echo_string(cli, "\r\n");
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+// prints the stats of the subcommands of group, with the group names
+// in front of them
+STATIC void stats_print_subcmds(struct cli *cli, const struct cli_cmd *group,
+				const struct cli_cmd_path *up)
+{
+	const struct cli_cmd_path path = { .up = up, 
+					   .name = group->command_name };
+
+	for (uint32_t i = 0; group->subcmd_cnt > i; i++)
+	{
+		const struct cli_cmd *cmd = &group->subcmds[i];
+		if (cmd->stats && cmd->stats->calls)
+		{
+			stats_print_path(cli, &path);
+		}
+		stats_print_cmd(cli, cmd);
+		stats_print_subcmds(cli, cmd, &path);
+	}
+}
+#endif
+
+// prints called commands available to the current user, example:
+// help: 3 calls, max 40
+//         <1:1 <32:1 <64:1
+STATIC void stats_cmd(struct cli *cli, char *s)
+{
+        (void) s;
+
+	struct cli_cmd_iter it;
+	for (const struct cli_cmd *tmp = cli_match_first(cli, &it, "", 0);
+	     NULL != tmp; tmp = cli_match_next(cli, &it, "", 0))
+	{
+		stats_print_cmd(cli, tmp);
+#ifdef ENABLE_SUBCOMMANDS
+		stats_print_subcmds(cli, tmp, NULL);
+#endif
+	}
+}
+#endif
+
+#if defined(ENABLE_USER_INPUT_REQUEST)
+bool cli_request_user_input(struct cli *cli, bool hide,
+			    void (*handler)(struct cli *cli, char *input))
+{
+	if (NULL == cli || NULL == handler || cli->input_handler)
+	{
+		return false;
+	}
+
+	cli->input_handler = handler;
+	cli->input_hide = hide;
+	return true;
+}
+
+char *cli_get_user_input(struct cli *cli, bool hide)
+{
+	// TODO: Do we need timeout here?
+	char c;
+
+#ifdef ENABLE_OUTPUT_BUFFER
+	// user must see the question before we start waiting
+	cli_output_flush(cli);
+#endif
+	for(;;)
+	{
+		if (cli_get_char(cli, &c))
+		{
+			char *input_received = 
+				cli_handle_new_character(cli, c, hide);
+			if (input_received)
+			{
+#ifdef ENABLE_OUTPUT_BUFFER
+				cli_output_flush(cli);
+#endif
+				return input_received;
+			}
+#ifdef ENABLE_OUTPUT_BUFFER
+			cli_output_flush(cli);
+#endif
+		}
+#ifdef ENABLE_OS_SUPPORT
+		if (cli->sleep_or_yield)
+		{
+			cli->sleep_or_yield();
+		}
+#endif
+	} 
+	return NULL;
+}
+#endif
+
+STATIC bool cli_settings_check(struct cli_settings *s)
+{
+	return !(NULL == s
+#ifdef ENABLE_ISR_INPUT
+		 // input can come only from the ISR ring
+#elif defined(ENABLE_BULK_INPUT)
+		 || (NULL == s->get_char && NULL == s->get_buf)
+#else
+		 || NULL == s->get_char
+#endif
+#ifdef ENABLE_OUTPUT_BUFFER
+		 || (NULL == s->send_char && NULL == s->send_buf)
+#else
+		 || NULL == s->send_char
+#endif
+		);
+}
+
+// initializes per session data
+STATIC void cli_session_init(struct cli *tmp, struct cli_registry *reg,
+			     struct cli_settings *s)
+{
+	tmp->reg = reg;
+	tmp->get_char = s->get_char;
+#ifdef ENABLE_BULK_INPUT
+	tmp->get_buf = s->get_buf;
+	tmp->in_buff_index = 0;
+	tmp->in_buff_len = 0;
+	tmp->in_data = tmp->in_buff;
+#endif
+#ifdef ENABLE_ISR_INPUT
+	tmp->rx_head = 0;
+	tmp->rx_tail = 0;
+	tmp->rx_overrun = 0;
+#endif
+	tmp->send_char = s->send_char;
+#ifdef ENABLE_OUTPUT_BUFFER
+	tmp->send_buf = s->send_buf;
+	tmp->out_buff_index = 0;
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+	tmp->send_space = s->send_space;
+	tmp->stream_it.cmd = NULL;
+#endif
+	tmp->input_buff_index = 0;
+	tmp->input_end_char = s->input_end_char;
+	tmp->special_sequence = false;
+	tmp->ssb_index = 0;
+#ifdef ENABLE_LINE_EDITING
+	tmp->input_tail = 0;
+#endif
+	tmp->current_user = &reg->users;
+
+#ifdef ENABLE_OS_SUPPORT
+	tmp->sleep_or_yield = s->sleep_or_yield;
+#endif
+
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	tmp->input_handler = NULL;
+	tmp->input_hide = false;
+#endif
+#ifdef ENABLE_USER_MANAGEMENT
+	tmp->su_user = NULL;
+#endif
+
+#ifdef ENABLE_AUTOCOMPLETE
+	tmp->ac_valid = false;
+#endif
+
+#ifdef ENABLE_COMMAND_STATUS
+	tmp->status = CLI_STATUS_OK;
+#endif
+#ifdef ENABLE_SCRIPT
+	tmp->in_script = false;
+#endif
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	tmp->running_cmd = NULL;
+	tmp->cmd_input = NULL;
+	tmp->cmd_step = 0;
+#endif
+#ifdef ENABLE_MACHINE_MODE
+	tmp->mm_enabled = false;
+	tmp->mm_busy = false;
+	tmp->mm_out_len = 0;
+	tmp->mm_state = CLI_MM_SOF;
+#endif
+
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+	tmp->logout_time_ms = s->logout_time_ms;
+	tmp->logout_timer_ms = 0;
+#endif
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+	cli_history_forget(tmp);
+#endif
+}
+
+struct cli *cli_init(struct cli_settings *s)
+{
+	if (!cli_settings_check(s) || NULL == s->my_malloc)
+	{
+		return NULL;
+	}
+	
+	struct cli_registry *reg = s->my_malloc(sizeof(struct cli_registry));
+
+	reg->malloc = s->my_malloc;
+	reg->common_cmd_list.next = NULL;
+	reg->common_tail = &reg->common_cmd_list;
+	reg->common_cmd_list.command_name = "help";
+	reg->common_cmd_list.command_description = 
+		"print out all the commands";
+	reg->common_cmd_list.command_function = help_cmd;
+#ifdef ENABLE_STREAMING_OUTPUT
+	reg->common_cmd_list.command_step = help_step;
+#elif defined(ENABLE_RESUMABLE_COMMANDS)
+	reg->common_cmd_list.command_step = NULL;
+#endif
+#ifdef ENABLE_ROLES
+	reg->common_cmd_list.roles = 0;
+#endif
+#ifdef ENABLE_SUBCOMMANDS
+	reg->common_cmd_list.subcmds = NULL;
+	reg->common_cmd_list.subcmd_cnt = 0;
+#endif
+#ifdef ENABLE_COMMAND_STATS
+	reg->common_cmd_list.stats = cli_stats_new(reg);
+	reg->get_timestamp = s->get_timestamp;
+#endif
+
+	reg->users.next = NULL;
+	reg->users.reg = reg;
+	reg->users.password_check = NULL;
+	reg->users.cmd_list = NULL;
+	reg->users.cmd_tail = NULL;
+#ifdef ENABLE_ROLES
+	// guest sees only the commands for all the users
+	reg->users.roles = 0;
+#endif
+	reg->users.prompt = s->prompt_user;
+	reg->users.name = "guest";
+	reg->users_tail = &reg->users;
+
+#ifdef ENABLE_COMMAND_INDEX
+	reg->index_valid = false;
+	reg->common_index.cmds = NULL;
+	reg->common_index.cnt = 0;
+	reg->users.index.cmds = NULL;
+	reg->users.index.cnt = 0;
+#endif
+
+	struct cli *tmp = s->my_malloc(sizeof(struct cli));
+	cli_session_init(tmp, reg, s);
+
 #ifdef ENABLE_USER_MANAGEMENT
 	// TODO: Check return code of adding SU command
 	cli_add_cmd_common(tmp, (struct cli_cmd_settings) 
@@ -398,14 +2500,82 @@ struct cli *cli_init(struct cli_settings *s)
 			   });
 #endif //ENABLE_USER_MANAGEMENT
 
+#ifdef ENABLE_COMMAND_STATS
+	cli_add_cmd_common(tmp, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "stats",
+				   .command_function = stats_cmd,
+				   .command_description = 
+				   "print command calls and times"
+			   });
+#endif
+
+	return tmp;
+}
+
+struct cli *cli_add_session(struct cli *cli, struct cli_settings *s)
+{
+	if (NULL == cli || !cli_settings_check(s))
+	{
+		return NULL;
+	}
+
+	struct cli *tmp = cli->reg->malloc(sizeof(struct cli));
+	cli_session_init(tmp, cli->reg, s);
 	return tmp;
 }
 
+void cli_session_reset(struct cli *cli)
+{
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	if (cli->running_cmd)
+	{
+		cli->running_cmd->command_step(cli, cli->cmd_input, 
+					       CLI_STEP_CANCEL);
+#ifdef ENABLE_COMMAND_STATS
+		cli_stats_record(cli->running_cmd->stats, cli->cmd_time);
+#endif
+	}
+#endif
+
+	// callbacks are kept, everything else is set as in a new session
+	struct cli_settings s = {
+		.get_char = cli->get_char,
+#ifdef ENABLE_BULK_INPUT
+		.get_buf = cli->get_buf,
+#endif
+		.send_char = cli->send_char,
+#ifdef ENABLE_OUTPUT_BUFFER
+		.send_buf = cli->send_buf,
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+		.send_space = cli->send_space,
+#endif
+#ifdef ENABLE_OS_SUPPORT
+		.sleep_or_yield = cli->sleep_or_yield,
+#endif
+		.input_end_char = cli->input_end_char,
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+		.logout_time_ms = cli->logout_time_ms,
+#endif
+	};
+	cli_session_init(cli, cli->reg, &s);
+}
+
 // automatic logout code
 #ifdef ENABLE_AUTOMATIC_LOGOUT
 STATIC void cli_logout_handler(struct cli *cli, 
 			       uint32_t time_from_last_run_ms)
 {
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	// running command keeps the session active, otherwise the guest 
+	// prompt would end up in its output while it keeps running
+	if (cli->running_cmd)
+	{
+		cli->logout_timer_ms = 0;
+		return;
+	}
+#endif
 	cli->logout_timer_ms += time_from_last_run_ms;
 
 	if (cli->logout_time_ms != 0 
@@ -418,6 +2588,16 @@ STATIC void cli_logout_handler(struct cli *cli,
 #endif
 		cli_change_current_user(cli, GET_GUEST_USER(cli));
 
+		// drop unfinished input, like a pending su password
+		cli->input_handler = NULL;
+		cli->input_hide = false;
+		cli->su_user = NULL;
+		cli->input_buff_index = 0;
+#ifdef ENABLE_LINE_EDITING
+		cli->input_tail = 0;
+#endif
+		echo_input_end_sequence(cli);
+
 		echo_string(cli, cli->current_user->prompt);
 		cli->logout_timer_ms = 0;
 	}
@@ -440,302 +2620,1005 @@ STATIC void cli_change_current_user(struct cli *cli,
 #if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
 	cli_history_forget(cli);
 #endif
+#if defined(ENABLE_AUTOCOMPLETE)
+	// cached candidates can be commands of the previous user
+	cli->ac_valid = false;
+#endif
+}
+
+bool cli_user_add_cmds(struct cli_user *user, 
+		       const struct cli_cmd_settings *cs, size_t n)
+{
+	if (NULL == user || (NULL == cs && 0 != n))
+	{
+		return false;
+	}
+	if (0 == n)
+	{
+		return true;
+	}
+
+	struct cli_cmd *new = cli_make_new_cmds(user->reg, cs, n);
+	if (NULL == new)
+	{
+		return false;
+	}
+
+	if (NULL == user->cmd_list)
+	{
+		// first cmd added to users list
+		user->cmd_list = new;
+	}
+	else
+	{
+		user->cmd_tail->next = new;
+	}
+	user->cmd_tail = &new[n - 1];
+
+#ifdef ENABLE_COMMAND_INDEX
+	user->reg->index_valid = false;
+#endif
+
+	return true;
 }
 
 bool cli_user_add_cmd(struct cli_user *user, struct cli_cmd_settings cs)
 {
-	if ((NULL == user))
+	return cli_user_add_cmds(user, &cs, 1);
+}
+
+struct cli_user *cli_add_user(struct cli *cli, 
+			      struct cli_user_settings us)
+{
+	if ((NULL == cli))
+	{
+		return NULL;
+	}
+
+	struct cli_user *tmp = cli->reg->malloc(sizeof(struct cli_user));
+	if (NULL == tmp)
+	{
+		return NULL;
+	}
+
+	// there is always guest user added when cli is initialized
+	cli->reg->users_tail->next = tmp;
+	cli->reg->users_tail = tmp;
+
+	tmp->next = NULL;
+        tmp->reg = cli->reg;
+	tmp->name = us.name;
+	tmp->password_check = us.password_check;
+	tmp->cmd_list = NULL;
+	tmp->cmd_tail = NULL;
+	tmp->prompt = us.prompt;
+#ifdef ENABLE_ROLES
+	tmp->roles = us.roles;
+#endif
+#ifdef ENABLE_COMMAND_INDEX
+	tmp->index.cmds = NULL;
+	tmp->index.cnt = 0;
+	cli->reg->index_valid = false;
+#endif
+
+	return tmp;
+}
+#endif //ENABLE_USER_MANAGEMENT
+
+#ifdef ENABLE_USER_MANAGEMENT
+STATIC void su_password_received(struct cli *cli, char *pass)
+{
+	if (cli->su_user->password_check(pass))
+	{
+		cli_change_current_user(cli, cli->su_user);
+	}
+#ifdef ENABLE_COMMAND_STATUS
+	else
+	{
+		cli->status = CLI_STATUS_FAILED;
+	}
+#endif
+	cli->su_user = NULL;
+}
+
+STATIC void su_user_name_received(struct cli *cli, char *u)
+{
+        struct cli_user *tmp = &cli->reg->users;
+        for (; NULL != tmp; tmp = tmp->next)
+	{
+		if (0 == strcmp(tmp->name, u))
+		{
+			if (tmp->password_check)
+			{
+				// password is checked when it arrives,
+				// cli_run keeps running in the meantime
+				cli->su_user = tmp;
+				echo_string(cli, "pass: ");
+				cli_request_user_input(
+					cli, true, su_password_received);
+			}
+			else
+			{
+				cli_change_current_user(cli, tmp);
+			}
+
+			return;
+		}
+	}
+#ifdef ENABLE_COMMAND_STATUS
+	cli->status = CLI_STATUS_FAILED;
+#endif
+}
+
+STATIC void su_cmd(struct cli *cli, char *s)
+{
+        (void) s;
+
+#ifdef ENABLE_ARGUMENT_PARSER
+	if (2 == cli_argument_parser_get_argc(cli))
+	{
+		su_user_name_received(
+			cli, cli_argumument_parser_get_next(cli, 1));
+		return;
+	}
+#endif
+	echo_string(cli, "user: ");
+	cli_request_user_input(cli, false, su_user_name_received);
+}
+#endif //ENABLE_USER_MANAGEMENT
+
+
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+// History is a ring buffer of null terminated commands, stored one
+// after another from the oldest to the newest. Entries are accessed
+// with offsets counted backwards from the head, where the next 
+// command will be written. Offset 1 is the null of the newest entry.
+STATIC char cli_history_byte(struct cli *cli, size_t back_offset)
+{
+	return cli->history[(cli->history_head + CLI_HISTORY_SIZE 
+			     - back_offset) % CLI_HISTORY_SIZE];
+}
+
+// returns length of the entry ending (with null) at offset end
+STATIC size_t cli_history_entry_len(struct cli *cli, size_t end)
+{
+	size_t len = 0;
+	while ((end + len + 1) <= cli->history_used
+	       && '\0' != cli_history_byte(cli, end + len + 1))
+	{
+		len += 1;
+	}
+	return len;
+}
+
+// finds the n-th newest entry (1 is the newest). Returns offset of
+// its end or 0 if there is no such entry
+STATIC size_t cli_history_find(struct cli *cli, uint32_t n, size_t *len)
+{
+	size_t end = 1;
+	for (; end <= cli->history_used; n--)
+	{
+		*len = cli_history_entry_len(cli, end);
+		if (1 == n)
+		{
+			return end;
+		}
+		end += *len + 1;
+	}
+	return 0;
+}
+
+STATIC void cli_history_save_cmd(struct cli *cli, char *input)
+{
+	size_t len = strlen(input);
+	size_t newest_len = 0;
+
+	if (0 == len || CLI_HISTORY_SIZE < (len + 1))
+	{
+		return;
+	}
+
+	// same command as the last one is not saved again
+	if (cli_history_find(cli, 1, &newest_len) && newest_len == len)
+	{
+		size_t i = 0;
+		for (; len > i 
+			     && input[i] == cli_history_byte(cli, 1 + len - i);
+		     i++);
+		if (len == i)
+		{
+			return;
+		}
+	}
+
+	// drop the oldest entries until the new one fits in
+	while ((cli->history_used + len + 1) > CLI_HISTORY_SIZE)
+	{
+		size_t oldest = (cli->history_head + CLI_HISTORY_SIZE
+				 - cli->history_used) % CLI_HISTORY_SIZE;
+		while ('\0' != cli->history[oldest])
+		{
+			oldest = (oldest + 1) % CLI_HISTORY_SIZE;
+			cli->history_used -= 1;
+		}
+		cli->history_used -= 1;
+	}
+
+	for (size_t i = 0; len >= i; i++)
+	{
+		cli->history[cli->history_head] = input[i];
+		cli->history_head = (uint16_t) 
+			((cli->history_head + 1) % CLI_HISTORY_SIZE);
+	}
+	cli->history_used = (uint16_t) (cli->history_used + len + 1);
+}
+
+// replaces current input with the n-th newest history entry
+STATIC bool cli_history_put_on_prompt(struct cli *cli, uint32_t n)
+{
+	size_t len = 0;
+	size_t end = cli_history_find(cli, n, &len);
+	if (0 == end || CLI_COMMAND_BUFF_SIZE <= len)
+	{
+		return false;
+	}
+
+#ifdef ENABLE_LINE_EDITING
+	char tmp[CLI_COMMAND_BUFF_SIZE];
+	for (size_t i = 0; len > i; i++)
+	{
+		tmp[i] = cli_history_byte(cli, end + len - i);
+	}
+	cli_line_replace(cli, tmp, len);
+#else
+	while (delete_last_echoed_char(cli));
+
+	for (size_t i = 0; len > i; i++)
+	{
+		cli->input_buff[i] = cli_history_byte(cli, end + len - i);
+	}
+	cli->input_buff[len] = '\0';
+	cli->input_buff_index = len;
+	echo_string(cli, cli->input_buff);
+#endif
+
+	cli->history_pos = (cli_history_pos_t) n;
+	return true;
+}
+
+STATIC void cli_history_forget(struct cli *cli)
+{
+	cli->history_head = 0;
+	cli->history_used = 0;
+	cli->history_pos = 0;
+}
+#endif
+
+#ifdef ENABLE_HISTORY_V1
+STATIC bool cli_history_handler_input_v1(struct cli *cli)
+{
+	if (0 == cli->input_buff_index)
+	{
+		return cli_history_put_on_prompt(cli, 1);
+	}
+	return false;
+
+}
+#endif
+
+#if defined(ENABLE_HISTORY_V2) || defined(ENABLE_LINE_EDITING)
+// https://en.wikipedia.org/wiki/ANSI_escape_code
+// Sequence is ESC, introducer ('[' or 'O', not checked because it 
+// differs between terminals), optional number and the final byte
+STATIC bool cli_special_sequence_handler(struct cli *cli, char c,
+					 bool hide_echo)
+{
+	if (0x1b == c)
+	{
+		cli->special_sequence = true;
+		cli->ssb_index = 0;
+		cli->ss_param = 0;
+		return true;
+	}
+
+#ifdef ENABLE_LINE_EDITING
+	// emacs style keys
+	if (0x01 == c || 0x05 == c)
+	{
+		c = (0x01 == c) ? 'H' : 'F';
+	}
+	else
+#endif
+	if (!cli->special_sequence)
+	{
+		return false;
+	}
+	else
+	{
+		cli->ssb_index += 1;
+		if (1 == cli->ssb_index)
+		{
+			return true;
+		}
+		if ('0' <= c && '9' >= c && 4 > cli->ssb_index)
+		{
+			cli->ss_param = (uint8_t) (cli->ss_param * 10 
+						   + (c - '0'));
+			return true;
+		}
+		cli->special_sequence = false;
+		cli->ssb_index = 0;
+	}
+
+	if ('~' == c)
+	{
+		// vt220 keys: 1 and 7 home, 3 delete, 4 and 8 end
+		const char vt[] = "?H?~F??HF";
+		c = (sizeof(vt) - 1 > cli->ss_param) ? vt[cli->ss_param] : '?';
+	}
+
+	if (hide_echo)
+	{
+		return true;
+	}
+
+	switch (c)
+	{
+#ifdef ENABLE_HISTORY_V2
+	case 'A': // up arrow
+		cli_history_put_on_prompt(cli, cli->history_pos + 1u);
+		break;
+	case 'B': // down arrow
+		if (1 == cli->history_pos)
+		{
+			// back to empty prompt
+#ifdef ENABLE_LINE_EDITING
+			cli_line_replace(cli, "", 0);
+#else
+			while (delete_last_echoed_char(cli));
+#endif
+			cli->history_pos = 0;
+		}
+		else if (cli->history_pos)
+		{
+			cli_history_put_on_prompt(cli, cli->history_pos - 1u);
+		}
+		break;
+#endif
+#ifdef ENABLE_LINE_EDITING
+	case 'C': // right arrow
+		if (cli->input_tail)
+		{
+			cli_cursor_move(cli, cli->input_buff_index 
+					- cli->input_tail + 1);
+		}
+		break;
+	case 'D': // left arrow
+		if (cli->input_buff_index > cli->input_tail)
+		{
+			cli_cursor_move(cli, cli->input_buff_index 
+					- cli->input_tail - 1);
+		}
+		break;
+	case 'H':
+		cli_cursor_move(cli, 0);
+		break;
+	case 'F':
+		cli_cursor_move(cli, cli->input_buff_index);
+		break;
+	case '~': // delete
+		cli_edit_delete(cli);
+		break;
+#endif
+	default:
+		break;
+	}
+	return true;
+}
+#endif
+
+#ifdef ENABLE_AUTOCOMPLETE
+// One pass over the commands matching the input. Remembers the first
+// match, number of matches and the length of their common prefix
+STATIC void cli_autocomplete_scan(struct cli *cli)
+{
+	const char *in = cli->input_buff;
+	size_t len = cli->input_buff_index;
+	struct cli_cmd_iter it;
+
+	const struct cli_cmd *first = cli_match_first(cli, &it, in, len);
+	cli->ac_first = it;
+	cli->ac_cnt = 0;
+	cli->ac_prefix_len = first ? strlen(first->command_name) : 0;
+
+	for (const struct cli_cmd *cmd = first; NULL != cmd;
+	     cmd = cli_match_next(cli, &it, in, len))
+	{
+		size_t i = len;
+		for (; cli->ac_prefix_len > i 
+			     && cmd->command_name[i] == first->command_name[i];
+		     i++);
+		cli->ac_prefix_len = i;
+		cli->ac_cnt += 1;
+	}
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+// Completes the last word of the input with the subcommands of the
+// group named by the words before it. Returns false if the input has
+// only one word (command name)
+STATIC bool cli_autocomplete_subcmd(struct cli *cli)
+{
+	char *in = cli->input_buff;
+	char *last = strrchr(in, ' ');
+	if (NULL == last)
 	{
 		return false;
 	}
+	last += 1;
+
+	// words before the last one must be groups
+	const struct cli_cmd *group = cli_search_command(cli, in);
+	for (char *w = cli_next_word(in); NULL != group && last != w;
+	     w = cli_next_word(w))
+	{
+		group = cli_subcmd_search(group, w, strcspn(w, " "));
+	}
+	if (NULL == group)
+	{
+		return true;
+	}
+
+	size_t len = strlen(last);
+	const struct cli_cmd *first = NULL;
+	uint32_t cnt = 0;
+	size_t prefix_len = 0;
+	for (uint32_t i = 0; group->subcmd_cnt > i; i++)
+	{
+		const struct cli_cmd *cmd = &group->subcmds[i];
+		if (!cli_cmd_name_starts_with(cmd, last, len))
+		{
+			continue;
+		}
+		if (NULL == first)
+		{
+			first = cmd;
+			prefix_len = strlen(cmd->command_name);
+		}
+		size_t n = len;
+		for (; prefix_len > n 
+			     && cmd->command_name[n] == first->command_name[n];
+		     n++);
+		prefix_len = n;
+		cnt += 1;
+	}
 
-	struct cli_cmd *new = cli_make_new_cmd(user->cli, cs);
-
-	if (NULL == user->cmd_list)
+	if (prefix_len > len)
 	{
-		// first cmd added to users list
-		user->cmd_list = new;
+		size_t n = prefix_len - len;
+		if (CLI_COMMAND_BUFF_SIZE <= cli->input_buff_index + n)
+		{
+			n = CLI_COMMAND_BUFF_SIZE - 1 - cli->input_buff_index;
+		}
+		cli_output(cli, &first->command_name[len], n);
+		memcpy(&cli->input_buff[cli->input_buff_index], 
+		       &first->command_name[len], n);
+		cli->input_buff_index += n;
+		cli->input_buff[cli->input_buff_index] = 0;
 	}
-	else
+	else if (1 < cnt)
 	{
-		cli_add_cmd_to_list(user->cmd_list, new);
+		cli_send_char(cli, '\n');
+		for (uint32_t i = 0; group->subcmd_cnt > i; i++)
+		{
+			const struct cli_cmd *cmd = &group->subcmds[i];
+			if (cli_cmd_name_starts_with(cmd, last, len))
+			{
+				echo_string(cli, cmd->command_name);
+				cli_send_char(cli, '\n');
+			}
+		}
+		echo_input_end_sequence(cli);
+		echo_string(cli, cli->current_user->prompt);
+		echo_string(cli, cli->input_buff);
 	}
-
 	return true;
 }
+#endif
 
-struct cli_user *cli_add_user(struct cli *cli, 
-			      struct cli_user_settings us)
+STATIC void cli_autocomplete(struct cli *cli)
 {
-	if ((NULL == cli))
+	cli->input_buff[cli->input_buff_index] = 0;
+
+#ifdef ENABLE_SUBCOMMANDS
+	if (cli_autocomplete_subcmd(cli))
 	{
-		return NULL;
+		return;
 	}
+#endif
+
+	// candidates stay the same until something else than tab 
+	// is pressed
+	if (!cli->ac_valid)
+	{
+		cli_autocomplete_scan(cli);
+		cli->ac_valid = true;
 
-	//tmp cant be NULL by design, because there is always 
-	// guest user added when cli is initialized
-        struct cli_user *tmp = &cli->users;
+		// complete the part which is common to all the matches
+		if (cli->ac_prefix_len > cli->input_buff_index)
+		{
+			const struct cli_cmd *cmd = cli->ac_first.cmd;
+			size_t n = cli->ac_prefix_len;
+			if (CLI_COMMAND_BUFF_SIZE <= n)
+			{
+				n = CLI_COMMAND_BUFF_SIZE - 1;
+			}
+			n -= cli->input_buff_index;
+
+			cli_output(cli, 
+				   &cmd->command_name[cli->input_buff_index],
+				   n);
+			memcpy(&cli->input_buff[cli->input_buff_index], 
+			       &cmd->command_name[cli->input_buff_index], n);
+			cli->input_buff_index += n;
+			cli->input_buff[cli->input_buff_index] = 0;
+			return;
+		}
+	}
 	
-        for (; NULL != tmp->next; tmp = tmp->next);
+	if (1 < cli->ac_cnt)
+	{
+		// all the candidates start with the current input, 
+		// listing starts at the first one
+		struct cli_cmd_iter it = cli->ac_first;
+		const struct cli_cmd *cmd = it.cmd;
 
-	tmp->next = cli->malloc(sizeof(struct cli_user));
-	tmp = tmp->next;
+		cli_send_char(cli, '\n');
+		for (uint32_t i = 0; cli->ac_cnt > i && NULL != cmd; i++)
+		{
+			echo_string(cli, cmd->command_name);
+			cli_send_char(cli, '\n');
+			cmd = cli_match_next(cli, &it, cli->input_buff,
+					     cli->input_buff_index);
+		}
 
-	tmp->next = NULL;
-        tmp->cli = cli;
-	tmp->name = us.name;
-	tmp->password_check = us.password_check;
-	tmp->cmd_list = NULL;
-	tmp->prompt = us.prompt;
+		echo_input_end_sequence(cli);
+		echo_string(cli, cli->current_user->prompt);
+		echo_string(cli, cli->input_buff);
+	}
+}
+#endif //ENABLE_AUTOCOMPLETE
 
-	return tmp;
+#ifdef ENABLE_ARGUMENT_PARSER
+STATIC bool cli_argument_parser_is_space(char c)
+{
+	return ' ' == c || '\t' == c;
 }
-#endif //ENABLE_USER_MANAGEMENT
 
-#ifdef ENABLE_USER_MANAGEMENT
-STATIC void su_cmd(struct cli *cli, char *s)
+// Splits the input in arguments in one pass. Arguments are separated
+// by any number of spaces, argument in double quotes can contain 
+// spaces. Start of each argument is saved, so they can be accessed
+// directly. Returns NULL or the reason the input cant be split: more
+// than CLI_MAX_ARGS arguments or a closing quote followed by text
+STATIC const char *cli_argumument_parser_reset(struct cli *cli)
 {
-        (void) s;
+	char *in = cli->input_buff;
+	size_t i = 0;
 
-	char *u = NULL;
-#ifdef ENABLE_ARGUMENT_PARSER
-	if (2 == cli_argument_parser_get_argc(cli))
-	{
-		u = cli_argumument_parser_get_next(cli, 1);
-	}
-	else
+	cli->argc = 0;
+
+	for (;;)
 	{
-		echo_string(cli, "user: ");
-		u = cli_get_user_input(cli, false);
-	}
-		
-#else
-	echo_string(cli, "user: ");
-	u = cli_get_user_input(cli, false);
+		for (; cli_argument_parser_is_space(in[i]); i++);
+		if ('\0' == in[i])
+		{
+			return NULL;
+		}
+		if (CLI_MAX_ARGS == cli->argc)
+		{
+			return "E: too many arguments";
+		}
 
-#endif
+		bool quoted = ('"' == in[i]);
+		if (quoted)
+		{
+			i += 1;
+		}
 
-        struct cli_user *tmp = &cli->users;
-        for (; NULL != tmp; tmp = tmp->next)
-	{
-		if (0 == strcmp(tmp->name, u))
+		cli->argv_offset[cli->argc] = (cli_arg_offset_t) i;
+		cli->argc += 1;
+
+		for (; '\0' != in[i]; i++)
 		{
-			if (tmp->password_check)
-			{
-				echo_string(cli, "pass: ");
-				if (tmp->password_check(
-					    cli_get_user_input(
-						    cli, true)))
-				{
-					cli_change_current_user(cli, 
-								tmp);
-				}
-			}
-			else
+			if (quoted ? ('"' == in[i]) 
+			    : cli_argument_parser_is_space(in[i]))
 			{
-				cli_change_current_user(cli, tmp);
+				in[i] = '\0';
+				i += 1;
+				break;
 			}
+		}
 
-			return;
+		// "a"b is not split in two arguments
+		if (quoted && '\0' != in[i] 
+		    && !cli_argument_parser_is_space(in[i]))
+		{
+			return "E: text after quote";
 		}
 	}
 }
-#endif //ENABLE_USER_MANAGEMENT
-
-
 
-#if defined(ENABLE_HISTORY_V1) \
-	|| defined(ENABLE_HISTORY_V2) \
-	|| defined(ENABLE_AUTOCOMPLETE)
-STATIC void cli_put_cmd_on_prompt(struct cli *cli, const char *name)
+#ifdef ENABLE_SUBCOMMANDS
+// drops the first n arguments (names of the groups), so the name 
+// of the subcommand is argv[0]
+STATIC void cli_argument_parser_shift(struct cli *cli, uint32_t n)
 {
-	echo_string(cli, name);
-	strncpy(cli->input_buff, name,
-		CLI_COMMAND_BUFF_SIZE);
-	cli->input_buff_index = strlen(
-		name);
+	if (n >= cli->argc)
+	{
+		return;
+	}
+	cli->argc = (uint8_t) (cli->argc - n);
+	memmove(&cli->argv_offset[0], &cli->argv_offset[n], 
+		cli->argc * sizeof(cli->argv_offset[0]));
 }
 #endif
 
-#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
-STATIC void cli_history_save_cmd(struct cli *cli, char *input)
+uint32_t cli_argument_parser_get_argc(struct cli *cli)
 {
-	strncpy(cli->previous_cmd, input, 
-		CLI_COMMAND_BUFF_SIZE);
+	return cli->argc;
 }
-#endif
 
-#if (defined(ENABLE_HISTORY_V1)	      \
-     || defined(ENABLE_HISTORY_V2))	\
-	&& defined(ENABLE_USER_MANAGEMENT)
-STATIC void cli_history_forget(struct cli *cli)
+char *cli_argumument_parser_get_next(struct cli *cli, uint32_t argn)
 {
-	cli->previous_cmd[0] = 0;
+	if (cli->argc > argn)
+	{
+		return &cli->input_buff[cli->argv_offset[argn]];
+	}
+	return NULL;
 }
-#endif
 
-#ifdef ENABLE_HISTORY_V1
-STATIC bool cli_history_handler_input_v1(struct cli *cli)
+uint32_t cli_argument_parser_get_argv(struct cli *cli, char **argv, 
+				      uint32_t argv_size)
 {
-	if ((0 == cli->input_buff_index) && (0 != cli->previous_cmd[0]))
+	uint32_t i = 0;
+	for (; cli->argc > i && argv_size > i; i++)
 	{
-		cli_put_cmd_on_prompt(cli, cli->previous_cmd);
-		
-		return true;
+		argv[i] = &cli->input_buff[cli->argv_offset[i]];
 	}
-	return false;
-
+	return i;
 }
 #endif
 
-#ifdef ENABLE_HISTORY_V2
-// TODO: cleanup, to complex and too many magic numbers
-// https://en.wikipedia.org/wiki/ANSI_escape_code
-STATIC bool cli_special_sequence_handler(struct cli *cli, char c)
+#ifdef ENABLE_ARGUMENT_SCHEMA
+STATIC bool cli_arg_parse_number(const char *s, uint32_t base, uint32_t *v)
 {
-	bool r = false;
-        //if(0x1b == c && (0 == cli->input_buff_index)) //special sequence start
-	if(0x1b == c)
+	uint32_t r = 0;
+
+	if ('\0' == *s)
 	{
-		cli->special_sequence = true;
-		r = true;
+		return false;
 	}
-	else if (cli->special_sequence)
+
+	for (; '\0' != *s; s++)
 	{
-		//cli->special_sequence_buff[cli->ssb_index] = c;
-		cli->ssb_index += 1;
-		r = true;
-		if (2 == cli->ssb_index)
+		uint32_t d;
+		char c = (char) (*s | 0x20); // lower case for hex
+
+		if ('0' <= *s && '9' >= *s)
+		{
+			d = (uint32_t) (*s - '0');
+		}
+		else if ('a' <= c && 'f' >= c)
+		{
+			d = (uint32_t) (c - 'a' + 10);
+		}
+		else
 		{
-			cli->special_sequence = false;
-			cli->ssb_index = 0;
+			return false;
+		}
 
-			// every special sequence first erase 
-			// the current prompt. This is the reason
-			// down arrow is not implemented :)
-			while (delete_last_echoed_char(cli));
+		if (base <= d || (UINT32_MAX - d) / base < r)
+		{
+			return false;
+		}
+		r = r * base + d;
+	}
 
-			// up arrow
-			// we dont need to check second byte atm,
-			// because it can differe between terminals
-			if (//(0x5b == cli->special_sequence_buff[0]) &&
-				(0x41 == c))
-			{
+	*v = r;
+	return true;
+}
 
-				cli_put_cmd_on_prompt(cli, 
-						      cli->previous_cmd);
-			}
-			// TODO: Add other special sequences if needed
+STATIC bool cli_arg_parse_value(const struct cli_arg *a, const char *s,
+				union cli_arg_value *v)
+{
+	// even index is false, odd is true
+	static const char *const bool_values[] = {
+		"0", "1", "off", "on", "false", "true", NULL
+	};
+	const char *const *values = a->enum_values;
+	uint32_t u;
+
+	switch (a->type)
+	{
+	case CLI_ARG_INT:
+	{
+		bool neg = ('-' == *s);
+		if (!cli_arg_parse_number(s + neg, 10, &u)
+		    || (neg ? 0x80000000u : (uint32_t) INT32_MAX) < u)
+		{
+			return false;
+		}
+		v->i = neg ? (int32_t) (0u - u) : (int32_t) u;
+		return a->min >= a->max 
+			|| (a->min <= v->i && a->max >= v->i);
+	}
+	case CLI_ARG_HEX:
+		if ('0' == s[0] && 'x' == (s[1] | 0x20))
+		{
+			s += 2;
 		}
+		if (!cli_arg_parse_number(s, 16, &v->u))
+		{
+			return false;
+		}
+		return a->umin >= a->umax
+			|| (a->umin <= v->u && a->umax >= v->u);
+	case CLI_ARG_BOOL:
+		values = bool_values;
+		break;
+	case CLI_ARG_ENUM:
+		break;
+	case CLI_ARG_STRING:
+		v->s = s;
+		return true;
+	default:
+		return false;
 	}
 
-	return r;
+	for (u = 0; NULL != values && NULL != values[u]; u++)
+	{
+		if (0 == strcmp(values[u], s))
+		{
+			if (CLI_ARG_BOOL == a->type)
+			{
+				v->b = u & 1;
+			}
+			else
+			{
+				v->u = u;
+			}
+			return true;
+		}
+	}
+	return false;
 }
-#endif
 
+STATIC bool cli_args_error(struct cli *cli, const char *msg, 
+			   const struct cli_arg *a)
+{
+	echo_string(cli, msg);
+	if (a)
+	{
+		echo_string(cli, a->name);
+	}
+	echo_input_end_sequence(cli);
+	return false;
+}
 
-#ifdef ENABLE_AUTOCOMPLETE
-STATIC void cli_autocomplete(struct cli *cli)
+// Matches the arguments split by the argument parser with the command
+// schema and parses them in cli->arg_values. Prints the reason and
+// returns false if the input doesnt match the schema
+STATIC bool cli_args_parse(struct cli *cli, const struct cli_cmd *cmd)
 {
-	uint32_t cmd_found_at_index = 0;
-	uint32_t search_from_index = 0;
-	uint32_t cmd_match_cnt = 0;
+	const struct cli_arg *args = cmd->args;
+	uint32_t cnt = cmd->arg_cnt;
+	uint32_t pos = 0; // next positional argument in schema
 
-	cli->input_buff[cli->input_buff_index] = 0;
-	
-	struct cli_cmd *cmd = cli_search_command(
-		cli, 
-		cli->input_buff,
-		true, 
-		search_from_index, 
-		NULL,
-		&cmd_match_cnt);
-	
-	if (1 < cmd_match_cnt)
+	if (CLI_MAX_ARGS < cnt)
+	{
+		cnt = CLI_MAX_ARGS;
+	}
+
+	cli->args_given = 0;
+	memset(cli->arg_values, 0, sizeof(cli->arg_values));
+
+	for (uint32_t i = 1; cli->argc > i; i++)
 	{
-		cli->send_char('\n');
-		for(;;)
+		const char *s = cli_argumument_parser_get_next(cli, i);
+		uint32_t n = cnt;
+
+		if ('-' == s[0] && '\0' != s[1] && '\0' == s[2])
 		{
-			cmd = cli_search_command(
-				cli, cli->input_buff,
-				true, cmd_found_at_index, 
-				&cmd_found_at_index, 
-				NULL);
-			if (cmd)
+			for (n = 0; cnt > n && s[1] != args[n].flag; n++);
+		}
+
+		if (cnt > n)
+		{
+			if (CLI_ARG_FLAG == args[n].type)
 			{
-				cmd_found_at_index += 1;
-				echo_string(cli, cmd->command_name);
-				cli->send_char('\n');
+				cli->arg_values[n].b = true;
+				cli->args_given |= 1u << n;
+				continue;
 			}
-			else
+
+			i += 1;
+			s = cli_argumument_parser_get_next(cli, i);
+			if (NULL == s)
 			{
-				break;
+				return cli_args_error(cli, "E: missing ",
+						      &args[n]);
+			}
+		}
+		else
+		{
+			for (; cnt > pos && '\0' != args[pos].flag; pos++);
+			if (cnt == pos)
+			{
+				return cli_args_error(
+					cli, "E: too many arguments", NULL);
 			}
+			n = pos;
+			pos += 1;
 		}
 
-		echo_input_end_sequence(cli);
-		echo_string(cli, cli->current_user->prompt);
-		echo_string(cli, cli->input_buff);
+		if (!cli_arg_parse_value(&args[n], s, &cli->arg_values[n]))
+		{
+			return cli_args_error(cli, "E: invalid ", &args[n]);
+		}
+		cli->args_given |= 1u << n;
 	}
-	else
+
+	for (uint32_t n = 0; cnt > n; n++)
 	{
-		cmd = cli_search_command(
-			cli, cli->input_buff, 
-			true, search_from_index, 
-			NULL,
-			NULL);
-		if (cmd)
+		if ('\0' == args[n].flag && !args[n].optional
+		    && 0 == (cli->args_given & (1u << n)))
 		{
-			while (delete_last_echoed_char(cli));
-			cli_put_cmd_on_prompt(cli, cmd->command_name);
+			return cli_args_error(cli, "E: missing ", &args[n]);
 		}
 	}
+	return true;
 }
-#endif //ENABLE_AUTOCOMPLETE
 
-#ifdef ENABLE_ARGUMENT_PARSER
-STATIC void cli_argumument_parser_reset(struct cli *cli)
+const union cli_arg_value *cli_get_args(struct cli *cli)
 {
-	cli->argc = 0;
+	return cli->arg_values;
+}
+
+bool cli_arg_given(struct cli *cli, uint32_t n)
+{
+	return CLI_MAX_ARGS > n && 0 != (cli->args_given & (1u << n));
+}
+#endif
+
+#ifdef ENABLE_COMMAND_INDEX
+// compares the command name with the first len characters of name,
+// same as strcmp would if name was terminated at len
+STATIC int cli_index_cmp(const char *cmd_name, const char *name, size_t len)
+{
+	int r = strncmp(cmd_name, name, len);
+	if (0 == r && '\0' != cmd_name[len])
+	{
+		r = 1;
+	}
+	return r;
+}
+
+// returns position of the first command which name is not smaller
+// than the first len characters of name
+STATIC uint32_t cli_index_lower_bound(struct cli_cmd_index *index,
+				      const char *name, size_t len)
+{
+	uint32_t low = 0;
+	uint32_t high = index->cnt;
 
-	for (uint32_t i = 0; 
-	     ('\0' != cli->input_buff[i]); i++)
+	while (low < high)
 	{
-		if (' ' == cli->input_buff[i])
+		uint32_t mid = low + ((high - low) / 2);
+		if (0 > cli_index_cmp(index->cmds[mid]->command_name, 
+				      name, len))
+		{
+			low = mid + 1;
+		}
+		else
 		{
-			cli->argc += 1;
-			cli->input_buff[i] = '\0';
+			high = mid;
 		}
 	}
+	return low;
+}
 
-	cli->argc += 1;
+STATIC void cli_index_insert(struct cli_cmd_index *index, uint32_t i,
+			     const struct cli_cmd *cmd)
+{
+	// insertion sort, the index is built only once and 
+	// the code is small
+	uint32_t j = i;
+	for (; 0 < j && 0 < strcmp(index->cmds[j-1]->command_name,
+				   cmd->command_name); j--)
+	{
+		index->cmds[j] = index->cmds[j-1];
+	}
+	index->cmds[j] = cmd;
 }
 
-uint32_t cli_argument_parser_get_argc(struct cli *cli)
+STATIC bool cli_index_build_from_list(struct cli_registry *reg,
+				      struct cli_cmd_index *index,
+				      struct cli_cmd *list,
+				      bool add_static_cmds)
 {
-	return cli->argc;
+	uint32_t cnt = 0;
+	for (struct cli_cmd *tmp = list; NULL != tmp; tmp = tmp->next)
+	{
+		cnt += 1;
+	}
+
+#ifdef ENABLE_STATIC_COMMANDS
+	if (add_static_cmds && STATIC_CMDS_START != STATIC_CMDS_END)
+	{
+		cnt += (uint32_t) (STATIC_CMDS_END - STATIC_CMDS_START);
+	}
+#else
+	(void) add_static_cmds;
+#endif
+
+	// reuse the old array if the commands still fit in
+	if (cnt > index->cnt)
+	{
+		index->cmds = reg->malloc(
+			cnt * sizeof(struct cli_cmd *));
+		if (NULL == index->cmds)
+		{
+			index->cnt = 0;
+			return false;
+		}
+	}
+	index->cnt = cnt;
+
+	uint32_t i = 0;
+	for (struct cli_cmd *tmp = list; NULL != tmp; tmp = tmp->next)
+	{
+		cli_index_insert(index, i, tmp);
+		i += 1;
+	}
+
+#ifdef ENABLE_STATIC_COMMANDS
+	for (const struct cli_cmd *tmp = STATIC_CMDS_START; 
+	     add_static_cmds && STATIC_CMDS_END != tmp; tmp++)
+	{
+		cli_index_insert(index, i, tmp);
+		i += 1;
+	}
+#endif
+	return true;
 }
 
-char *cli_argumument_parser_get_next(struct cli *cli, uint32_t argn)
+bool cli_build_command_index(struct cli *cli)
 {
-	char *arg_start = NULL;
-	uint32_t arg_cnt = 0;
-	if (cli->argc > argn)
+	if (NULL == cli)
 	{
-		arg_start = cli->input_buff;
-		for (uint32_t i = 0; CLI_COMMAND_BUFF_SIZE > i; i += 1)
+		return false;
+	}
+
+	struct cli_registry *reg = cli->reg;
+	reg->index_valid = false;
+
+	if (!cli_index_build_from_list(reg, &reg->common_index,
+				       &reg->common_cmd_list, true))
+	{
+		return false;
+	}
+
+	for (struct cli_user *u = &reg->users; NULL != u; u = u->next)
+	{
+		if (!cli_index_build_from_list(reg, &u->index, 
+					       u->cmd_list, false))
 		{
-			if ('\0' == cli->input_buff[i])
-			{
-				if (argn == arg_cnt)
-				{
-					break;
-				}
-				arg_start = &cli->input_buff[i+1];
-				arg_cnt += 1;
-			}
+			return false;
 		}
 	}
-	return arg_start;
+
+	reg->index_valid = true;
+	return true;
 }
 #endif
@@ -41,10 +41,102 @@
 // input. If only one command will match user input, 
 // it will be autocompleted
 
+// #define ENABLE_BULK_INPUT
+// input is read in chunks (CLI_INPUT_CHUNK_SIZE) with get_buf 
+// callback. If get_buf is not set, get_char is used
+
+// #define ENABLE_OUTPUT_BUFFER
+// output is collected in a buffer (CLI_OUTPUT_BUFF_SIZE) and sent in
+// blocks with send_buf callback. If send_buf is not set, send_char
+// is used as without the buffer
+
+// #define ENABLE_STATIC_COMMANDS
+// commands can be added at compile time with CLI_COMMAND macro.
+// They are stored in flash and dont need any RAM
+
+// #define ENABLE_PERFECT_HASH
+// static commands are found with a perfect hash generated at build
+// time by scripts/cli_phash_gen.py (needs ENABLE_STATIC_COMMANDS)
+
+// #define ENABLE_COMMAND_INDEX
+// cli_build_command_index can be called after all the commands are
+// added. It builds sorted arrays of commands, so the command search
+// is done with binary search instead of walking the command lists
+
+// #define ENABLE_RESUMABLE_COMMANDS
+// commands can do their work in steps, cli_run calls one step per
+// run. Ctrl-C cancels the running command
+
+// #define ENABLE_LINE_EDITING
+// cursor can be moved with left and right arrows, home and end
+// (Ctrl-A, Ctrl-E) and characters inserted and deleted anywhere in the
+// line. Terminal is updated with the least bytes possible
+
+// #define ENABLE_SUBCOMMANDS
+// commands can be groups of subcommands (eth phy read). Each level is
+// a small table, input is matched one word per level
+
+// #define ENABLE_ISR_INPUT
+// input can be pushed from an ISR to a lock free ring, which cli_run
+// drains. get_char and get_buf are not needed then
+
+// #define ENABLE_PRINTF
+// cli_printf and cli_write for command output, formatted on the stack
+// without heap or the C library printf
+
+// #define ENABLE_STREAMING_OUTPUT
+// resumable command steps run only when the transport has room for
+// output (send_space callback), help is printed in chunks 
+// (enables ENABLE_RESUMABLE_COMMANDS)
+
+// #define ENABLE_COMMAND_STATUS
+// commands can report their result with cli_set_status
+
+// #define ENABLE_SCRIPT
+// cli_exec_script runs commands from a buffer without echo and 
+// prompts (enables ENABLE_COMMAND_STATUS)
+
+// #define ENABLE_MACHINE_MODE
+// cli_machine_mode switches the session to framed requests and 
+// responses with CRC, without echo and prompts (enables 
+// ENABLE_COMMAND_STATUS)
+
+// #define ENABLE_COMMAND_STATS
+// counts command calls and measures their execution time in log2
+// histograms (with get_timestamp callback). Built-in stats command
+// prints them
+
+// #define ENABLE_ARGUMENT_SCHEMA
+// commands can declare their arguments (int, hex, bool, enum, string
+// and -f flags). Arguments are parsed and checked before the command
+// is called (needs ENABLE_ARGUMENT_PARSER)
+
+// #define ENABLE_ROLES
+// commands and users have role bitmasks. Command is visible to the
+// users sharing a role with it, so a command shared by many users is
+// added only once to the common commands (enables ENABLE_USER_MANAGEMENT)
+
+#if defined(ENABLE_ROLES) && !defined(ENABLE_USER_MANAGEMENT)
+#define ENABLE_USER_MANAGEMENT
+#endif
+
 #if defined(ENABLE_USER_MANAGEMENT) && !defined(ENABLE_USER_INPUT_REQUEST)
 #define ENABLE_USER_INPUT_REQUEST
 #endif
 
+#if (defined(ENABLE_SCRIPT) || defined(ENABLE_MACHINE_MODE)) \
+	&& !defined(ENABLE_COMMAND_STATUS)
+#define ENABLE_COMMAND_STATUS
+#endif
+
+#if defined(ENABLE_STREAMING_OUTPUT) && !defined(ENABLE_RESUMABLE_COMMANDS)
+#define ENABLE_RESUMABLE_COMMANDS
+#endif
+
+#if defined(ENABLE_ARGUMENT_SCHEMA) && !defined(ENABLE_ARGUMENT_PARSER)
+#define ENABLE_ARGUMENT_PARSER
+#endif
+
 struct cli;
 struct cli_user;
 
@@ -52,6 +144,207 @@ struct cli_user_settings {
 	char *name;
 	bool (*password_check)(char *d);
 	char *prompt;
+#ifdef ENABLE_ROLES
+	// roles of the user, bit n is role n
+	uint32_t roles;
+#endif
+};
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+enum cli_arg_type {
+	CLI_ARG_INT,	// decimal, can be negative
+	CLI_ARG_HEX,	// hex with or without 0x
+	CLI_ARG_BOOL,	// 1/0, on/off, true/false
+	CLI_ARG_ENUM,	// one of enum_values, value is its index
+	CLI_ARG_STRING,	// pointer to the argument in the input buffer
+	CLI_ARG_FLAG,	// -f without a value, true if given
+};
+
+// One argument of the command. Arguments without flag are positional
+// and are given in the schema order. Arguments with flag are given
+// as -f value (or only -f for CLI_ARG_FLAG) anywhere in the input
+// and are always optional
+struct cli_arg {
+	const char *name;
+	uint8_t type;
+	char flag;
+	bool optional;
+	// range checked only if min < max, umin and umax for hex
+	union {
+		int32_t min;
+		uint32_t umin;
+	};
+	union {
+		int32_t max;
+		uint32_t umax;
+	};
+	// null terminated list of values for enum
+	const char *const *enum_values;
+};
+
+union cli_arg_value {
+	int32_t i;
+	uint32_t u;
+	bool b;
+	const char *s;
+};
+
+#define CLI_ARG_CNT(args) ((uint8_t) (sizeof(args) / sizeof((args)[0])))
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+#ifndef CLI_STATS_HIST_SIZE
+#define CLI_STATS_HIST_SIZE 16
+#endif
+
+// Bucket n of the histogram counts calls which took less than 2^n 
+// and at least 2^(n-1) timestamp units. Last bucket counts all longer
+// calls. Counters stop at their max value
+struct cli_cmd_stats {
+	uint32_t calls;
+	uint32_t max_time;
+	uint16_t time_hist[CLI_STATS_HIST_SIZE];
+};
+
+#define CLI_COMMAND_STATS_DEFINE(name)				\
+	static struct cli_cmd_stats cli_cmd_stats_##name;
+#define CLI_COMMAND_STATS_INIT(name)				\
+	.stats = &cli_cmd_stats_##name,
+#else
+#define CLI_COMMAND_STATS_DEFINE(name)
+#define CLI_COMMAND_STATS_INIT(name)
+#endif
+
+#ifdef ENABLE_STATIC_COMMANDS
+// Adds a command at compile time. The command is placed in the
+// cli_cmds section, so it doesnt use any RAM. Name is given without
+// quotes and must be a valid C identifier, example:
+// CLI_COMMAND(reboot, "reboot the cpu", reboot_cli);
+// When using a custom linker script, the section must be kept and
+// the start and end symbols defined (see README.md)
+#define CLI_COMMAND(name, description, function)			\
+	CLI_COMMAND_STATS_DEFINE(name)					\
+	const struct cli_cmd cli_cmd_##name				\
+	__attribute__((used, section("cli_cmds"),			\
+		       aligned(sizeof(void *)))) = {			\
+		.next = NULL,						\
+		.command_name = #name,					\
+		.command_description = description,			\
+		.command_function = function,				\
+		CLI_COMMAND_STATS_INIT(name)				\
+	}
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+// Same as CLI_COMMAND, arg_list is an array of struct cli_arg
+#define CLI_COMMAND_ARGS(name, description, function, arg_list)		\
+	CLI_COMMAND_STATS_DEFINE(name)					\
+	const struct cli_cmd cli_cmd_##name				\
+	__attribute__((used, section("cli_cmds"),			\
+		       aligned(sizeof(void *)))) = {			\
+		.next = NULL,						\
+		.command_name = #name,					\
+		.command_description = description,			\
+		.command_function = function,				\
+		.args = arg_list,					\
+		.arg_cnt = CLI_ARG_CNT(arg_list),			\
+		CLI_COMMAND_STATS_INIT(name)				\
+	}
+#endif
+#endif
+
+#ifdef ENABLE_SUBCOMMANDS
+#define CLI_SUBCMD_CNT(cmds) ((uint8_t) (sizeof(cmds) / sizeof((cmds)[0])))
+
+#ifdef ENABLE_COMMAND_STATS
+// compound literal at file scope has static storage
+#define CLI_SUBCOMMAND_STATS_INIT					\
+	.stats = &(struct cli_cmd_stats) { .calls = 0 },
+#else
+#define CLI_SUBCOMMAND_STATS_INIT
+#endif
+
+// Entries of a subcommand table, name is a string. Tables must be 
+// defined at file scope, example:
+// static const struct cli_cmd phy_cmds[] = {
+//	CLI_SUBCOMMAND("read", "read phy register", phy_read_cli),
+//	CLI_SUBCOMMAND("write", "write phy register", phy_write_cli),
+// };
+#define CLI_SUBCOMMAND(name, description, function)			\
+	{								\
+		.next = NULL,						\
+		.command_name = name,					\
+		.command_description = description,			\
+		.command_function = function,				\
+		CLI_SUBCOMMAND_STATS_INIT				\
+	}
+
+// subcommand which is a group of the subcommands in table
+#define CLI_SUBCOMMAND_GROUP(name, description, table)			\
+	{								\
+		.next = NULL,						\
+		.command_name = name,					\
+		.command_description = description,			\
+		.subcmds = table,					\
+		.subcmd_cnt = CLI_SUBCMD_CNT(table),			\
+		CLI_SUBCOMMAND_STATS_INIT				\
+	}
+
+#ifdef ENABLE_STATIC_COMMANDS
+// Same as CLI_COMMAND, adds a group of the subcommands in table
+#define CLI_COMMAND_GROUP(name, description, table)			\
+	CLI_COMMAND_STATS_DEFINE(name)					\
+	const struct cli_cmd cli_cmd_##name				\
+	__attribute__((used, section("cli_cmds"),			\
+		       aligned(sizeof(void *)))) = {			\
+		.next = NULL,						\
+		.command_name = #name,					\
+		.command_description = description,			\
+		.subcmds = table,					\
+		.subcmd_cnt = CLI_SUBCMD_CNT(table),			\
+		CLI_COMMAND_STATS_INIT(name)				\
+	}
+#endif
+#endif
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+// step given to command_step when the command is cancelled
+#define CLI_STEP_CANCEL UINT32_MAX
+#endif
+
+struct cli_cmd {
+        struct cli_cmd *next;
+        const char *command_name;
+        const char *command_description;
+        void (*command_function)(struct cli *cli, 
+				 char *command_input_string);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	// used instead of command_function if set. Called with step 0
+	// when the command is received, then once per cli_run with 
+	// the next step until it returns false (no more work). 
+	// Called with CLI_STEP_CANCEL on Ctrl-C, return value is 
+	// ignored then
+	bool (*command_step)(struct cli *cli, char *command_input_string,
+			     uint32_t step);
+#endif
+#ifdef ENABLE_ARGUMENT_SCHEMA
+	const struct cli_arg *args;
+	uint8_t arg_cnt;
+#endif
+#ifdef ENABLE_ROLES
+	// command is visible to the users with any of these roles, 
+	// 0 means to all the users (also guest)
+	uint32_t roles;
+#endif
+#ifdef ENABLE_SUBCOMMANDS
+	// table of the next level. If the next word of the input is
+	// one of them, it is called instead. Group without 
+	// command_function lists them
+	const struct cli_cmd *subcmds;
+	uint8_t subcmd_cnt;
+#endif
+#ifdef ENABLE_COMMAND_STATS
+	struct cli_cmd_stats *stats;
+#endif
 };
 
 struct cli_cmd_settings {
@@ -59,12 +352,40 @@ struct cli_cmd_settings {
         const char *command_description;
         void (*command_function)(struct cli *cli, 
 				 char *command_input_string);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	bool (*command_step)(struct cli *cli, char *command_input_string,
+			     uint32_t step);
+#endif
+#ifdef ENABLE_ARGUMENT_SCHEMA
+	const struct cli_arg *args;
+	uint8_t arg_cnt;
+#endif
+#ifdef ENABLE_ROLES
+	uint32_t roles;
+#endif
+#ifdef ENABLE_SUBCOMMANDS
+	const struct cli_cmd *subcmds;
+	uint8_t subcmd_cnt;
+#endif
 };
 
 struct cli_settings {
         void *(*my_malloc)(size_t size);
         bool (*get_char)(char *);
+#ifdef ENABLE_BULK_INPUT
+	// optional, returns number of characters copied to buf
+	size_t (*get_buf)(char *buf, size_t size);
+#endif
         void (*send_char)(char c);
+#ifdef ENABLE_OUTPUT_BUFFER
+	// optional, data must be sent or copied before returning
+	void (*send_buf)(const char *buf, size_t len);
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+	// optional, returns number of bytes the transport can take 
+	// without blocking
+	size_t (*send_space)(void);
+#endif
 #ifdef ENABLE_OS_SUPPORT
 	void (*sleep_or_yield)(void);
 #endif	
@@ -74,19 +395,163 @@ struct cli_settings {
 #ifdef ENABLE_AUTOMATIC_LOGOUT
 	uint32_t logout_time_ms;
 #endif
+
+#ifdef ENABLE_COMMAND_STATS
+	// optional, any free running timer (us, cpu cycles...). Only 
+	// the one given to cli_init is used
+	uint32_t (*get_timestamp)(void);
+#endif
 };
 
+#if defined(ENABLE_USER_INPUT_REQUEST)
+// Asks for user input without blocking. Command calls it and returns,
+// the handler is called from cli_run when the user input is complete.
+// Returns false if another input request is already pending
+bool cli_request_user_input(struct cli *cli, bool hide,
+			    void (*handler)(struct cli *cli, char *input));
+
+// Blocks until user input is complete
 char *cli_get_user_input(struct cli *cli, bool hide);
+#endif
+
+#ifdef ENABLE_COMMAND_STATUS
+// statuses set by cli, commands can use any other value
+enum cli_status {
+	CLI_STATUS_OK = 0,
+	CLI_STATUS_FAILED = -1,
+	CLI_STATUS_UNKNOWN_CMD = -2,
+	CLI_STATUS_BAD_ARGS = -3,
+	CLI_STATUS_TOO_LONG = -4,
+	CLI_STATUS_BAD_FRAME = -5,
+	CLI_STATUS_CANCELLED = -6,
+};
+
+// Sets the result of the running command, status is CLI_STATUS_OK 
+// if the command doesnt set it
+void cli_set_status(struct cli *cli, int32_t status);
+#endif
+
+#ifdef ENABLE_SCRIPT
+struct cli_script_result {
+	// executed lines, empty and comment lines are not counted
+	uint32_t executed;
+	uint32_t failed;
+	// first failed line (first line is 1), 0 if none failed
+	uint32_t error_line;
+	int32_t error_status;
+};
+
+// Runs newline separated commands from buf as if they were typed, but
+// without echo, prompts and history. Empty lines and lines starting
+// with # are skipped. Input requested by a command is taken from the
+// next line. Stops at the first failed line if stop_on_error is set.
+// result can be NULL. Returns true if all the lines were successful.
+// Must not be called from a command
+bool cli_exec_script(struct cli *cli, const char *buf, size_t len,
+		     bool stop_on_error, struct cli_script_result *result);
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+// Frame: SOF, type, seq, len, len bytes of payload, CRC16 (CCITT, 
+// init 0xffff, high byte first) of type, seq, len and payload
+#define CLI_FRAME_SOF 0xa5
+
+enum cli_frame_type {
+	// request, payload is the command line
+	CLI_FRAME_CMD = 'C',
+	// response, payload is a part of the command output
+	CLI_FRAME_DATA = 'D',
+	// last response to a request, payload is the status (int32_t,
+	// little endian)
+	CLI_FRAME_END = 'E',
+};
+
+// In machine mode the input is read as request frames. Each request
+// is answered with DATA frames and one END frame with the same seq.
+// There is no echo, prompt or line editing. Can be called from a 
+// command, the END frame of the request is still sent
+void cli_machine_mode(struct cli *cli, bool enable);
+#endif
 
 bool cli_add_cmd_common(struct cli *cli, struct cli_cmd_settings cs);
+// Adds n commands with one allocation, in the array order. Settings
+// are copied, the array can be a local variable
+bool cli_add_cmds(struct cli *cli, const struct cli_cmd_settings *cs,
+		  size_t n);
 struct cli_user *cli_add_user(struct cli *cli, struct cli_user_settings us);
 bool cli_user_add_cmd(struct cli_user *user, struct cli_cmd_settings cs);
+bool cli_user_add_cmds(struct cli_user *user, 
+		       const struct cli_cmd_settings *cs, size_t n);
 
 struct cli *cli_init(struct cli_settings *s);
+// Adds a new session (terminal), which shares commands and users
+// with cli. my_malloc and prompt_user settings are not used
+struct cli *cli_add_session(struct cli *cli, struct cli_settings *s);
+
+// Drops the session state (current user, input, history, running 
+// command is cancelled) and keeps the callbacks, so the session can 
+// be reused for a new connection. Sessions are never freed
+void cli_session_reset(struct cli *cli);
+
+// returned by cli_run when nothing is pending until new input
+#define CLI_RUN_IDLE UINT32_MAX
+
+// Handles the new input, pending command steps and the logout timer.
+// Returns ms until it has to be called again if there is no new 
+// input: 0 while a command has more steps, time to the automatic 
+// logout or CLI_RUN_IDLE
 uint32_t cli_run(struct cli *cli, uint32_t time_from_last_run_ms);
 
+#ifdef ENABLE_COMMAND_INDEX
+bool cli_build_command_index(struct cli *cli);
+#endif
+
+#ifdef ENABLE_PRINTF
+#include <stdarg.h>
+
+// Command output goes through the same path as the echo (output 
+// buffer, machine mode frames). Formats: %d %i %u %x %X %c %s %p %%,
+// flags - and 0, width and hh, h, l, z modifiers. Formatting stops at
+// any other conversion (ll, precision, float...) and the rest of fmt
+// is sent as text, example:
+// cli_printf(cli, "%08lx: %-6s %d\r\n", addr, name, value);
+void cli_write(struct cli *cli, const char *buf, size_t len);
+void cli_printf(struct cli *cli, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void cli_vprintf(struct cli *cli, const char *fmt, va_list ap);
+#endif
+
+#ifdef ENABLE_STREAMING_OUTPUT
+// Number of bytes which can be sent without blocking, SIZE_MAX if 
+// send_space is not set. Command step can use it to size its chunk
+size_t cli_output_space(struct cli *cli);
+#endif
+
+#ifdef ENABLE_ISR_INPUT
+// Producer side of the input ring (CLI_ISR_RING_SIZE bytes, power of
+// two). Can be called from one ISR (or thread) per session without 
+// locking. Ring is used as input when get_char and get_buf are NULL. 
+// Characters which dont fit are dropped and counted as overruns
+bool cli_push_char_from_isr(struct cli *cli, char c);
+// returns number of characters stored
+size_t cli_push_buf_from_isr(struct cli *cli, const char *buf, size_t len);
+uint32_t cli_isr_overrun_cnt(struct cli *cli);
+#endif
+
 #ifdef ENABLE_ARGUMENT_PARSER
 uint32_t cli_argument_parser_get_argc(struct cli *cli);
 char *cli_argumument_parser_get_next(struct cli *cli, uint32_t argn);
+// fills argv with pointers to arguments (argv[0] is command name),
+// returns number of arguments written
+uint32_t cli_argument_parser_get_argv(struct cli *cli, char **argv, 
+				      uint32_t argv_size);
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+// parsed values of the command arguments, in the schema order.
+// Valid only while the command is running
+const union cli_arg_value *cli_get_args(struct cli *cli);
+// true if the n-th argument of the schema was given
+bool cli_arg_given(struct cli *cli, uint32_t n);
 #endif
 #endif
@@ -22,41 +22,179 @@
 #define CLI_COMMAND_BUFF_SIZE 32
 #endif
 
+#ifndef CLI_MAX_ARGS
+#define CLI_MAX_ARGS 8
+#endif
+
+#if CLI_COMMAND_BUFF_SIZE > 256
+typedef uint16_t cli_arg_offset_t;
+#else
+typedef uint8_t cli_arg_offset_t;
+#endif
+
+#if defined(ENABLE_ARGUMENT_SCHEMA) && CLI_MAX_ARGS > 32
+#error E: CLI_MAX_ARGS must be 32 or less with ENABLE_ARGUMENT_SCHEMA
+#endif
+
+#if defined(ENABLE_COMMAND_STATS) \
+	&& (CLI_STATS_HIST_SIZE < 2 || CLI_STATS_HIST_SIZE > 32)
+#error E: CLI_STATS_HIST_SIZE must be between 2 and 32
+#endif
+
+#ifndef CLI_MACHINE_DATA_SIZE
+#define CLI_MACHINE_DATA_SIZE 64
+#endif
+
+#if defined(ENABLE_MACHINE_MODE) && CLI_MACHINE_DATA_SIZE > 255
+#error E: CLI_MACHINE_DATA_SIZE must fit in the frame len byte
+#endif
+
+#ifndef CLI_PHASH_HEADER
+#define CLI_PHASH_HEADER "cli_phash.h"
+#endif
+
+#ifndef CLI_HISTORY_SIZE
+#define CLI_HISTORY_SIZE (2 * CLI_COMMAND_BUFF_SIZE)
+#endif
+
+#if CLI_HISTORY_SIZE < CLI_COMMAND_BUFF_SIZE
+#error E: CLI_HISTORY_SIZE must fit at least one command
+#endif
+
+#if CLI_HISTORY_SIZE > 65535
+#error E: CLI_HISTORY_SIZE must fit in 16 bits
+#endif
+
+// entry takes at least 2 bytes, so there are max CLI_HISTORY_SIZE / 2
+#if CLI_HISTORY_SIZE > 511
+typedef uint16_t cli_history_pos_t;
+#else
+typedef uint8_t cli_history_pos_t;
+#endif
+
+#ifndef CLI_INPUT_CHUNK_SIZE
+#define CLI_INPUT_CHUNK_SIZE 64
+#endif
+
+#ifndef CLI_ISR_RING_SIZE
+#define CLI_ISR_RING_SIZE 128
+#endif
+
+#if 0 != (CLI_ISR_RING_SIZE & (CLI_ISR_RING_SIZE - 1))
+#error E: CLI_ISR_RING_SIZE must be a power of two
+#endif
+
+#ifndef CLI_OUTPUT_BUFF_SIZE
+#define CLI_OUTPUT_BUFF_SIZE 64
+#endif
+
+#ifndef CLI_STREAM_MIN_SPACE
+// running command step is called only when the transport can take 
+// at least this many bytes
+#define CLI_STREAM_MIN_SPACE 16
+#endif
+
 struct cli;
+struct cli_cmd;
+
+#ifdef ENABLE_COMMAND_INDEX
+// commands sorted by name
+struct cli_cmd_index {
+	const struct cli_cmd **cmds;
+	uint32_t cnt;
+};
+#endif
+
+struct cli_registry;
 struct cli_user {
 	struct cli_user *next;	
-	struct cli *cli;
+	struct cli_registry *reg;
 	char *name;
 	bool (*password_check)(char *d);
+#ifdef ENABLE_ROLES
+	uint32_t roles;
+#endif
         struct cli_cmd *cmd_list;
+	// last command in cmd_list, commands are appended in O(1)
+	struct cli_cmd *cmd_tail;
 	char *prompt;
+#ifdef ENABLE_COMMAND_INDEX
+	struct cli_cmd_index index;
+#endif
+};
+
+// sources of the commands, in the order they are searched
+enum cli_cmd_src {
+	CLI_CMD_SRC_COMMON = 0,
+	CLI_CMD_SRC_STATIC,
+	CLI_CMD_SRC_USER,
+	CLI_CMD_SRC_CNT,
+};
+
+struct cli_cmd_iter {
+	const struct cli_cmd *cmd;
+#ifdef ENABLE_COMMAND_INDEX
+	// position in the index array
+	uint32_t pos;
+#endif
+	uint8_t src;
 };
 
-struct cli_cmd {
-        struct cli_cmd *next;
-        const char *command_name;
-        const char *command_description;
-        void (*command_function)(struct cli *cli, 
-				 char *command_input_string);
+// commands and users, shared by all the sessions
+struct cli_registry {
+        void *(*malloc)(size_t size);
+	// first user is guest
+	struct cli_user users;
+	struct cli_user *users_tail;
+        struct cli_cmd common_cmd_list;
+	struct cli_cmd *common_tail;
+#ifdef ENABLE_COMMAND_INDEX
+	struct cli_cmd_index common_index;
+	// cleared when a command is added after the index was built
+	bool index_valid;
+#endif
+#ifdef ENABLE_COMMAND_STATS
+	uint32_t (*get_timestamp)(void);
+#endif
 };
 
+// one session (terminal)
 struct cli {
+	struct cli_registry *reg;
 
 #ifdef ENABLE_AUTOMATIC_LOGOUT
 	uint32_t logout_time_ms;
 	uint32_t logout_timer_ms;
 #endif
 
-        void *(*malloc)(size_t size);
         bool (*get_char)(char *);
+#ifdef ENABLE_BULK_INPUT
+	size_t (*get_buf)(char *buf, size_t size);
+#endif
         void (*send_char)(char c);
+#ifdef ENABLE_OUTPUT_BUFFER
+	void (*send_buf)(const char *buf, size_t len);
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+	size_t (*send_space)(void);
+	// next command printed by the streaming help
+	struct cli_cmd_iter stream_it;
+#endif
 #ifdef ENABLE_OS_SUPPORT
 	void (*sleep_or_yield)(void);
 #endif	
-	struct cli_user users;
 	struct cli_user *current_user;
 
-        struct cli_cmd common_cmd_list;
+#if defined(ENABLE_USER_INPUT_REQUEST)
+	// set while a command waits for user input
+	void (*input_handler)(struct cli *cli, char *input);
+	bool input_hide;
+#endif
+#ifdef ENABLE_USER_MANAGEMENT
+	// user waiting for password check
+	struct cli_user *su_user;
+#endif
+
         size_t input_buff_index;
 
         char input_end_char;
@@ -64,15 +202,96 @@ struct cli {
         bool special_sequence;
 	uint8_t ssb_index;
 	//char special_sequence_buff[2];
+	// number in the sequence, like 3 in ESC [ 3 ~
+	uint8_t ss_param;
+#ifdef ENABLE_LINE_EDITING
+	// number of characters right of the cursor
+	size_t input_tail;
+#endif
 
 #ifdef ENABLE_ARGUMENT_PARSER
 	uint8_t argc;
+	// start of each argument in input_buff
+	cli_arg_offset_t argv_offset[CLI_MAX_ARGS];
+#endif
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	// command with more steps pending, NULL if none
+	const struct cli_cmd *running_cmd;
+	// part of the input the command was called with
+	char *cmd_input;
+	uint32_t cmd_step;
+#ifdef ENABLE_COMMAND_STATS
+	// time of the steps done so far
+	uint32_t cmd_time;
+#endif
+#endif
+
+#ifdef ENABLE_COMMAND_STATUS
+	int32_t status;
+#endif
+#ifdef ENABLE_SCRIPT
+	bool in_script;
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+	bool mm_enabled;
+	// request is being executed, output goes in DATA frames
+	bool mm_busy;
+	uint8_t mm_state;
+	uint8_t mm_type;
+	uint8_t mm_seq;
+	uint8_t mm_len;
+	uint8_t mm_index;
+	uint16_t mm_crc;
+	uint8_t mm_out_len;
+	char mm_out[CLI_MACHINE_DATA_SIZE];
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+	// bit n is set if n-th schema argument was given
+	uint32_t args_given;
+	union cli_arg_value arg_values[CLI_MAX_ARGS];
 #endif
 
 #if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
-        char previous_cmd[CLI_COMMAND_BUFF_SIZE];
+	uint16_t history_head;
+	uint16_t history_used;
+	// history entry on the prompt, 0 if none
+	cli_history_pos_t history_pos;
+	char history[CLI_HISTORY_SIZE];
 #endif
         char input_buff[CLI_COMMAND_BUFF_SIZE];
+
+#ifdef ENABLE_AUTOCOMPLETE
+	// candidates found by the last tab press
+	struct cli_cmd_iter ac_first;
+	uint32_t ac_cnt;
+	size_t ac_prefix_len;
+	bool ac_valid;
+#endif
+
+#ifdef ENABLE_BULK_INPUT
+	size_t in_buff_index;
+	size_t in_buff_len;
+	// current chunk, in_buff or a part of the ISR ring
+	const char *in_data;
+	char in_buff[CLI_INPUT_CHUNK_SIZE];
+#endif
+
+#ifdef ENABLE_ISR_INPUT
+	char rx_ring[CLI_ISR_RING_SIZE];
+	// written only by the ISR
+	uint32_t rx_head;
+	uint32_t rx_overrun;
+	// written only by cli_run
+	uint32_t rx_tail;
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+	size_t out_buff_index;
+	char out_buff[CLI_OUTPUT_BUFF_SIZE];
+#endif
 };
 
 #ifdef ENABLE_AUTOMATIC_LOGOUT
@@ -84,28 +303,81 @@ STATIC void cli_reset_logout_timer(struct cli *cli);
 #endif //automatic logout
 
 #ifdef ENABLE_ARGUMENT_PARSER
-STATIC void cli_argumument_parser_reset(struct cli *cli);
+STATIC const char *cli_argumument_parser_reset(struct cli *cli);
 char *cli_argumument_parser_get_next(struct cli *cli, uint32_t argn);
+#ifdef ENABLE_SUBCOMMANDS
+STATIC void cli_argument_parser_shift(struct cli *cli, uint32_t n);
+#endif
+#endif
+
+#ifdef ENABLE_SUBCOMMANDS
+STATIC const struct cli_cmd *cli_subcmd_search(const struct cli_cmd *group,
+					       const char *name, size_t len);
+STATIC const struct cli_cmd *cli_subcmd_descend(const struct cli_cmd *cmd,
+						char **input, 
+						uint32_t *depth);
+STATIC void cli_subcmd_help(struct cli *cli, const struct cli_cmd *group);
+#endif
+
+STATIC void cli_input_line_handler(struct cli *cli, char *input);
+STATIC uint32_t cli_next_run_ms(struct cli *cli);
+#ifdef ENABLE_RESUMABLE_COMMANDS
+STATIC void cli_command_step(struct cli *cli);
+STATIC void cli_command_cancel(struct cli *cli);
+#endif
+#ifdef ENABLE_STREAMING_OUTPUT
+STATIC bool help_step(struct cli *cli, char *s, uint32_t step);
+#endif
+#ifdef ENABLE_SCRIPT
+STATIC int32_t cli_script_line(struct cli *cli, const char *line, 
+			       size_t len);
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+STATIC uint16_t cli_crc16(uint16_t crc, uint8_t b);
+STATIC void cli_machine_rx(struct cli *cli, uint8_t c);
+STATIC void cli_machine_request_end(struct cli *cli, int32_t status);
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+STATIC void cli_stats_record(struct cli_cmd_stats *st, uint32_t time);
+STATIC void stats_cmd(struct cli *cli, char *s);
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+STATIC bool cli_arg_parse_value(const struct cli_arg *a, const char *s,
+				union cli_arg_value *v);
+STATIC bool cli_args_parse(struct cli *cli, const struct cli_cmd *cmd);
 #endif
 
 #if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
-STATIC void cli_put_cmd_on_prompt(struct cli *cli, const char *name);
 STATIC void cli_history_save_cmd(struct cli *cli, char *input);
 #endif // history common
 
-#if (defined(ENABLE_HISTORY_V1)	      \
-     || defined(ENABLE_HISTORY_V2))	\
-	&& defined(ENABLE_USER_MANAGEMENT)
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
 STATIC void cli_history_forget(struct cli *cli);
+STATIC bool cli_history_put_on_prompt(struct cli *cli, uint32_t n);
 #endif
 
 
 #if defined(ENABLE_HISTORY_V1)
 STATIC bool cli_history_handler_input_v1(struct cli *cli);
 #endif // history v1
-#if defined(ENABLE_HISTORY_V2)
-STATIC bool cli_special_sequence_handler(struct cli *cli, char c);
-#endif // history v2
+#ifdef ENABLE_LINE_EDITING
+STATIC size_t cli_csi_len(size_t n);
+STATIC void cli_echo_csi(struct cli *cli, size_t n, char x);
+STATIC void cli_cursor_move(struct cli *cli, size_t pos);
+STATIC void cli_edit_insert(struct cli *cli, char c);
+STATIC void cli_edit_delete(struct cli *cli);
+STATIC void cli_edit_backspace(struct cli *cli);
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+STATIC void cli_line_replace(struct cli *cli, const char *s, size_t len);
+#endif
+#endif
+#if defined(ENABLE_HISTORY_V2) || defined(ENABLE_LINE_EDITING)
+STATIC bool cli_special_sequence_handler(struct cli *cli, char c,
+					 bool hide_echo);
+#endif // history v2 or line editing
 
 #ifdef ENABLE_USER_MANAGEMENT
 bool cli_user_add_cmd(struct cli_user *user, 
@@ -121,16 +393,31 @@ STATIC void cli_change_current_user(struct cli *cli,
 STATIC void cli_autocomplete(struct cli *cli);
 #endif
 
+#ifdef ENABLE_PERFECT_HASH
+STATIC const struct cli_cmd *cli_phash_search(const char *name, 
+					      size_t len);
+#endif
+
+#ifdef ENABLE_COMMAND_INDEX
+STATIC uint32_t cli_index_lower_bound(struct cli_cmd_index *index,
+				      const char *name, size_t len);
+#endif
+
 
 #ifdef UNIT_TESTS
 void echo_string(struct cli *cli, const char *s);
+#ifdef ENABLE_OUTPUT_BUFFER
+void cli_output_flush(struct cli *cli);
+#endif
 bool delete_last_echoed_char(struct cli *cli);
-struct cli_cmd *cli_search_command(struct cli *cli, 
-				   char *cmd_name,
-				   bool match_unfinished_cmds,
-				   uint32_t search_after_index,
-				   uint32_t *found_at_index,
-				   uint32_t *name_match_cnt);
+const struct cli_cmd *cli_search_command(struct cli *cli, 
+					 const char *input);
+const struct cli_cmd *cli_match_first(struct cli *cli,
+				      struct cli_cmd_iter *it,
+				      const char *prefix, size_t len);
+const struct cli_cmd *cli_match_next(struct cli *cli,
+				     struct cli_cmd_iter *it,
+				     const char *prefix, size_t len);
 
 
 char *cli_handle_new_character(struct cli *cli, char c, bool hide);
@@ -0,0 +1,306 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Izidor Makuc <izidor@makuc.info>
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Benchmarks the cli_run hot path with synthetic input and output:
+// - input characters per second with get_char and get_buf
+// - time per command dispatch with 10, 100 and 1000 commands
+// - cost of one tab press
+// - bytes sent per input character
+// The same file is built with different module combinations (see
+// bench target in Makefile), BENCH_CONFIG is the name of the combo
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cli.h"
+
+#ifndef BENCH_CONFIG
+#define BENCH_CONFIG "default"
+#endif
+
+#define BENCH_INPUT_SIZE (4u * 1024u * 1024u)
+// input size for dispatch and tab tests, 1000 commands are slow
+// without the index
+#define BENCH_CMD_INPUT_SIZE (256u * 1024u)
+// size of one USB full speed packet
+#define BENCH_CHUNK_SIZE 64u
+// different command lines used in dispatch and tab tests
+#define BENCH_LINE_CNT 64u
+#define BENCH_LINE_SIZE 24u
+
+static char *bench_input;
+static size_t bench_input_index;
+static size_t bench_input_size;
+
+static volatile uint32_t bench_sent_cnt;
+static volatile uint32_t bench_cmd_cnt;
+
+static bool bench_get_char(char *c)
+{
+	if (bench_input_index < bench_input_size)
+	{
+		*c = bench_input[bench_input_index];
+		bench_input_index += 1;
+		return true;
+	}
+	return false;
+}
+
+#ifdef ENABLE_BULK_INPUT
+static size_t bench_get_buf(char *buf, size_t size)
+{
+	size_t n = bench_input_size - bench_input_index;
+	if (n > size)
+	{
+		n = size;
+	}
+	if (n > BENCH_CHUNK_SIZE)
+	{
+		n = BENCH_CHUNK_SIZE;
+	}
+	memcpy(buf, &bench_input[bench_input_index], n);
+	bench_input_index += n;
+	return n;
+}
+#endif
+
+static void bench_send_char(char c)
+{
+	(void) c;
+	bench_sent_cnt += 1;
+}
+
+#ifdef ENABLE_OUTPUT_BUFFER
+static void bench_send_buf(const char *buf, size_t len)
+{
+	(void) buf;
+	bench_sent_cnt += (uint32_t) len;
+}
+#endif
+
+static void bench_cmd(struct cli *cli, char *s)
+{
+	(void) cli;
+	(void) s;
+	bench_cmd_cnt += 1;
+}
+
+// fills the input with the lines repeated one after another, only
+// whole lines are used. Returns number of lines in the input
+static size_t bench_input_fill(char lines[][BENCH_LINE_SIZE],
+			       uint32_t line_cnt, size_t size)
+{
+	size_t i = 0;
+	size_t cnt = 0;
+
+	for (uint32_t l = 0;; l = (l + 1) % line_cnt, cnt++)
+	{
+		size_t len = strlen(lines[l]);
+		if (i + len > size)
+		{
+			break;
+		}
+		memcpy(&bench_input[i], lines[l], len);
+		i += len;
+	}
+	bench_input_size = i;
+	return cnt;
+}
+
+static double bench_time_s(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double) t.tv_sec + ((double) t.tv_nsec / 1e9);
+}
+
+// new cli with bench_cmd and cmd_cnt commands named c0000, c0001...
+static struct cli *bench_cli_get(struct cli_settings *s, uint32_t cmd_cnt)
+{
+	struct cli *cli = cli_init(s);
+	if (NULL == cli)
+	{
+		return NULL;
+	}
+
+	cli_add_cmd_common(cli, (struct cli_cmd_settings)
+			   {
+				   .command_name = "bench_cmd",
+				   .command_function = bench_cmd,
+			   });
+
+	for (uint32_t i = 0; cmd_cnt > i; i++)
+	{
+		char *name = malloc(8);
+		snprintf(name, 8, "c%04" PRIu32, i % 10000u);
+		cli_add_cmd_common(cli, (struct cli_cmd_settings)
+				   {
+					   .command_name = name,
+					   .command_function = bench_cmd,
+				   });
+	}
+	return cli;
+}
+
+// runs the whole input through cli, returns time in seconds
+static double bench_feed(struct cli *cli)
+{
+	bench_input_index = 0;
+	bench_sent_cnt = 0;
+	bench_cmd_cnt = 0;
+
+	double start = bench_time_s();
+	while (bench_input_index < bench_input_size)
+	{
+		cli_run(cli, 0);
+	}
+	return bench_time_s() - start;
+}
+
+static void bench_throughput(const char *name, struct cli_settings *s)
+{
+	char line[][BENCH_LINE_SIZE] = { "bench_cmd 0x2000 128\r" };
+	struct cli *cli = bench_cli_get(s, 0);
+	if (NULL == cli)
+	{
+		printf("%-24s init failed\n", name);
+		return;
+	}
+
+	bench_input_fill(line, 1, BENCH_INPUT_SIZE);
+	double t = bench_feed(cli);
+
+	printf("%-24s %12.0f chars/s %10.2f bytes/char\n",
+	       name, (double) bench_input_size / t,
+	       (double) bench_sent_cnt / (double) bench_input_size);
+}
+
+// lines with pseudo random commands, end is added to each of them
+static void bench_cmd_lines_get(char lines[][BENCH_LINE_SIZE],
+				uint32_t cmd_cnt, uint32_t name_len,
+				const char *end)
+{
+	uint32_t r = 12345;
+
+	for (uint32_t i = 0; BENCH_LINE_CNT > i; i++)
+	{
+		r = r * 1103515245u + 12345u;
+		snprintf(lines[i], BENCH_LINE_SIZE, "c%04" PRIu32, 
+			 (r >> 8) % cmd_cnt);
+		lines[i][name_len] = '\0';
+		strcat(lines[i], end);
+	}
+}
+
+static void bench_dispatch(struct cli *cli, const char *name,
+			   uint32_t cmd_cnt)
+{
+	char lines[BENCH_LINE_CNT][BENCH_LINE_SIZE];
+
+	bench_cmd_lines_get(lines, cmd_cnt, 5, "\r");
+	bench_input_fill(lines, BENCH_LINE_CNT, BENCH_CMD_INPUT_SIZE);
+	double t = bench_feed(cli);
+
+	printf("%-24s %12.1f ns/cmd  %10.2f bytes/char\n",
+	       name, t * 1e9 / (double) bench_cmd_cnt,
+	       (double) bench_sent_cnt / (double) bench_input_size);
+}
+
+#ifdef ENABLE_AUTOCOMPLETE
+// prefix of 4 characters matches 10 commands, tab lists them. Cost
+// of a tab is the difference to the same lines without it
+static void bench_tab(struct cli *cli, const char *name, uint32_t cmd_cnt)
+{
+	char lines[BENCH_LINE_CNT][BENCH_LINE_SIZE];
+
+	bench_cmd_lines_get(lines, cmd_cnt, 4, "\r");
+	size_t cnt = bench_input_fill(lines, BENCH_LINE_CNT, 
+				      BENCH_CMD_INPUT_SIZE);
+	double t_no_tab = bench_feed(cli) / (double) cnt;
+
+	bench_cmd_lines_get(lines, cmd_cnt, 4, "\t\r");
+	cnt = bench_input_fill(lines, BENCH_LINE_CNT, BENCH_CMD_INPUT_SIZE);
+	double t = bench_feed(cli) / (double) cnt;
+
+	printf("%-24s %12.1f ns/tab  %10.2f bytes/char\n",
+	       name, (t - t_no_tab) * 1e9,
+	       (double) bench_sent_cnt / (double) bench_input_size);
+}
+#endif
+
+static void bench_commands(struct cli_settings *s)
+{
+	const uint32_t cnt[] = { 10, 100, 1000 };
+
+	for (uint32_t i = 0; (sizeof(cnt) / sizeof(cnt[0])) > i; i++)
+	{
+		char name[32];
+		struct cli *cli = bench_cli_get(s, cnt[i]);
+		if (NULL == cli)
+		{
+			printf("init failed\n");
+			return;
+		}
+
+		snprintf(name, sizeof(name), "dispatch %" PRIu32, cnt[i]);
+		bench_dispatch(cli, name, cnt[i]);
+#ifdef ENABLE_AUTOCOMPLETE
+		snprintf(name, sizeof(name), "tab %" PRIu32, cnt[i]);
+		bench_tab(cli, name, cnt[i]);
+#endif
+
+#ifdef ENABLE_COMMAND_INDEX
+		cli_build_command_index(cli);
+		snprintf(name, sizeof(name), "dispatch %" PRIu32 " index",
+			 cnt[i]);
+		bench_dispatch(cli, name, cnt[i]);
+#ifdef ENABLE_AUTOCOMPLETE
+		snprintf(name, sizeof(name), "tab %" PRIu32 " index", cnt[i]);
+		bench_tab(cli, name, cnt[i]);
+#endif
+#endif
+	}
+}
+
+int main(void)
+{
+	bench_input = malloc(BENCH_INPUT_SIZE);
+
+	printf("config: %s\n", BENCH_CONFIG);
+
+	struct cli_settings s = {
+		.my_malloc = malloc,
+		.get_char = bench_get_char,
+		.send_char = bench_send_char,
+		.input_end_char = '\r',
+		.prompt_user = "bench> ",
+	};
+	bench_throughput("get_char", &s);
+	bench_commands(&s);
+
+#ifdef ENABLE_BULK_INPUT
+	s.get_char = NULL;
+	s.get_buf = bench_get_buf;
+	bench_throughput("get_buf", &s);
+
+#ifdef ENABLE_OUTPUT_BUFFER
+	s.send_char = NULL;
+	s.send_buf = bench_send_buf;
+	bench_throughput("get_buf + send_buf", &s);
+	bench_commands(&s);
+#endif
+#endif
+
+	printf("\n");
+	free(bench_input);
+	return 0;
+}
@@ -36,6 +36,41 @@ static void send_char_test(char c)
 
 }
 
+static const char *test_input;
+
+// returns characters from test_input string
+static bool get_char_from_string(char *c)
+{
+	if (NULL == test_input || '\0' == *test_input)
+	{
+		return false;
+	}
+	*c = *test_input;
+	test_input += 1;
+	return true;
+}
+
+#ifdef ENABLE_BULK_INPUT
+// returns test_input in chunks of max 5 characters
+static size_t get_buf_from_string(char *buf, size_t size)
+{
+	size_t n = 0;
+	for (; size > n && 5 > n && get_char_from_string(&buf[n]); n++);
+	return n;
+}
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+static uint32_t send_buf_call_cnt;
+
+static void send_buf_test(const char *buf, size_t len)
+{
+	memcpy(&send_char_buff[send_char_buff_index], buf, len);
+	send_char_buff_index += (uint32_t) len;
+	send_buf_call_cnt += 1;
+}
+#endif
+
 static void cli_function_01(struct cli *cli, char *s)
 {
 	(void)(cli);
@@ -66,6 +101,161 @@ struct cli_cmd cli_f02 = {
 	.command_function = cli_function_02,
 };
 
+#ifdef ENABLE_STATIC_COMMANDS
+static uint32_t cli_static_function_call_cnt = 0;
+
+static void cli_static_function(struct cli *cli, char *s)
+{
+	(void)(cli);
+	(void)(s);
+	cli_static_function_call_cnt += 1;
+}
+
+CLI_COMMAND(s01, "static test command 01", cli_static_function);
+CLI_COMMAND(s02, "static test command 02", cli_static_function);
+// commands in comments are not in the perfect hash table, the test
+// would not link: CLI_COMMAND(s03, "commented out", cli_static_function);
+#ifdef ENABLE_NOT_DEFINED
+// nor with commands in disabled blocks (generator gets --cpp)
+CLI_COMMAND(s04, "disabled", cli_static_function);
+#endif
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+static const char *const mode_values[] = {"slow", "fast", NULL};
+
+static const struct cli_arg mem_args[] = {
+	{ .name = "addr", .type = CLI_ARG_HEX },
+	{ .name = "len", .type = CLI_ARG_INT, .optional = true,
+	  .min = 1, .max = 64 },
+	{ .name = "v", .type = CLI_ARG_FLAG, .flag = 'v' },
+	{ .name = "mode", .type = CLI_ARG_ENUM, .flag = 'm',
+	  .enum_values = mode_values },
+};
+
+static uint32_t cli_schema_function_call_cnt;
+static union cli_arg_value schema_args[CLI_ARG_CNT(mem_args)];
+static bool schema_len_given;
+
+static void cli_schema_function(struct cli *cli, char *s)
+{
+	(void)(s);
+	memcpy(schema_args, cli_get_args(cli), sizeof(schema_args));
+	schema_len_given = cli_arg_given(cli, 1);
+	cli_schema_function_call_cnt += 1;
+}
+
+#ifdef ENABLE_STATIC_COMMANDS
+CLI_COMMAND_ARGS(mrd, "static command with arguments", 
+		 cli_schema_function, mem_args);
+#endif
+#endif
+
+#ifdef ENABLE_SUBCOMMANDS
+static uint32_t phy_read_call_cnt;
+static char *phy_read_argv[CLI_MAX_ARGS];
+static uint32_t phy_read_argc;
+
+static void phy_read_function(struct cli *cli, char *s)
+{
+	(void) s;
+	phy_read_call_cnt += 1;
+	phy_read_argc = cli_argument_parser_get_argv(cli, phy_read_argv,
+						     CLI_MAX_ARGS);
+}
+
+static const struct cli_cmd phy_cmds[] = {
+	CLI_SUBCOMMAND("read", "read phy register", phy_read_function),
+	CLI_SUBCOMMAND("reset", "reset phy", cli_function_01),
+};
+
+static const struct cli_cmd eth_cmds[] = {
+	CLI_SUBCOMMAND_GROUP("phy", "phy registers", phy_cmds),
+	CLI_SUBCOMMAND("stat", NULL, cli_function_02),
+};
+
+static const struct cli_cmd_settings eth_cmd = {
+	.command_name = "eth",
+	.command_description = "ethernet",
+	.subcmds = eth_cmds,
+	.subcmd_cnt = CLI_SUBCMD_CNT(eth_cmds),
+};
+#endif
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+static uint32_t step_last;
+static uint32_t step_call_cnt;
+
+// does its work in 4 steps
+static bool cli_step_function(struct cli *cli, char *s, uint32_t step)
+{
+	(void)(cli);
+	(void)(s);
+	step_last = step;
+	step_call_cnt += 1;
+	return 3 > step;
+}
+
+static const struct cli_cmd_settings steps_cmd = {
+	.command_name = "steps",
+	.command_step = cli_step_function,
+};
+#endif
+
+// number of commands starting with prefix
+static uint32_t match_cnt_get(struct cli *c, const char *prefix)
+{
+	struct cli_cmd_iter it;
+	uint32_t cnt = 0;
+	size_t len = strlen(prefix);
+	for (const struct cli_cmd *cmd = cli_match_first(c, &it, prefix, len);
+	     NULL != cmd; cmd = cli_match_next(c, &it, prefix, len))
+	{
+		cnt += 1;
+	}
+	return cnt;
+}
+
+static const struct cli_cmd_settings f01_cmd = {
+	.command_name = "f01",
+	.command_function = cli_function_01,
+};
+
+// New cli for a test. Fields of s left zero get the defaults (malloc,
+// send_char_test, '\n' and "cli>" prompt), input callback is set by 
+// the test. cmd is added as a common command if given
+static struct cli *test_cli_get(struct cli_settings s,
+				const struct cli_cmd_settings *cmd)
+{
+	if (NULL == s.my_malloc)
+	{
+		s.my_malloc = malloc;
+	}
+#ifdef ENABLE_OUTPUT_BUFFER
+	if (NULL == s.send_char && NULL == s.send_buf)
+#else
+	if (NULL == s.send_char)
+#endif
+	{
+		s.send_char = send_char_test;
+	}
+	if ('\0' == s.input_end_char)
+	{
+		s.input_end_char = '\n';
+	}
+	if (NULL == s.prompt_user)
+	{
+		s.prompt_user = "cli>";
+	}
+
+	struct cli *c = cli_init(&s);
+	if (NULL != c && NULL != cmd)
+	{
+		cli_add_cmd_common(c, *cmd);
+	}
+	return c;
+}
+
 void setUp(void)
 {
 	memset(get_char_buff, 0, sizeof(get_char_buff));
@@ -75,6 +265,18 @@ void setUp(void)
 	send_char_buff_index = 0;
 
 	cli_function_01_call_cnt = 0;
+	cli_function_02_call_cnt = 0;
+	test_input = NULL;
+#ifdef ENABLE_RESUMABLE_COMMANDS
+	step_call_cnt = 0;
+	step_last = 0;
+#endif
+#ifdef ENABLE_SUBCOMMANDS
+	phy_read_call_cnt = 0;
+#endif
+#ifdef ENABLE_OUTPUT_BUFFER
+	send_buf_call_cnt = 0;
+#endif
 	
 	cli_f01.next = NULL;
 	cli_f02.next = NULL;
@@ -118,7 +320,12 @@ void test_cli_init(void)
 	struct cli_settings missing_get_char;
 	memcpy(&missing_get_char, &s, sizeof(struct cli_settings));
 	missing_get_char.get_char = NULL;
+#ifdef ENABLE_ISR_INPUT
+	// input comes from the ISR ring
+	TEST_ASSERT_NOT_NULL(cli_init(&missing_get_char));
+#else
 	TEST_ASSERT_NULL(cli_init(&missing_get_char));
+#endif
 
 	struct cli_settings missing_send_char;
 	memcpy(&missing_send_char, &s, sizeof(struct cli_settings));
@@ -194,8 +401,14 @@ void test_cli_add_cmd(void)
 
 	//cli_add_cmd_common(cli_default, &cli_f01);
 
-	//TEST_ASSERT_EQUAL_PTR(&cli_f01, cli_default->common_cmd_list.next);
-	TEST_ASSERT_NULL(cli_default->common_cmd_list.next->next->next);
+	// help, su (and stats) are added by cli_init
+	struct cli_cmd *last_init_cmd = cli_default->reg->common_cmd_list.next;
+#ifdef ENABLE_COMMAND_STATS
+	last_init_cmd = last_init_cmd->next;
+#endif
+
+	//TEST_ASSERT_EQUAL_PTR(&cli_f01, cli_default->reg->common_cmd_list.next);
+	TEST_ASSERT_NULL(last_init_cmd->next->next);
 
 	//cli_add_cmd_common(cli_default, &cli_f02);
 	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
@@ -207,8 +420,73 @@ void test_cli_add_cmd(void)
 			   });
 
 	//TEST_ASSERT_EQUAL_PTR(&cli_f02, 
-	//		      cli_default->common_cmd_list.next->next);
-	TEST_ASSERT_NULL(cli_default->common_cmd_list.next->next->next->next);
+	//		      cli_default->reg->common_cmd_list.next->next);
+	TEST_ASSERT_NULL(last_init_cmd->next->next->next);
+}
+
+static uint32_t malloc_cnt;
+
+static void *malloc_counting(size_t size)
+{
+	malloc_cnt += 1;
+	return malloc(size);
+}
+
+void test_cli_add_cmds(void)
+{
+	const struct cli_cmd_settings cs[] = {
+		{ .command_name = "b01", .command_function = cli_function_01 },
+		{ .command_name = "b02", .command_function = cli_function_02 },
+		{ .command_name = "b03", .command_function = cli_function_01 },
+	};
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.my_malloc = malloc_counting,
+			.get_char = get_char_test,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// one allocation for all the commands
+	malloc_cnt = 0;
+	TEST_ASSERT_TRUE(cli_add_cmds(c, cs, 3));
+	TEST_ASSERT_EQUAL_UINT32(1, malloc_cnt);
+	struct cli_cmd *b01 = c->reg->common_tail - 2;
+	TEST_ASSERT_TRUE(cli_add_cmds(c, NULL, 0));
+	TEST_ASSERT_FALSE(cli_add_cmds(c, NULL, 1));
+	TEST_ASSERT_TRUE(cli_add_cmd_common(c, cs[0]));
+
+	// appended in the array order, single command after them
+	TEST_ASSERT_EQUAL_STRING("b01", b01->command_name);
+	TEST_ASSERT_EQUAL_PTR(&b01[1], b01->next);
+	TEST_ASSERT_EQUAL_PTR(&b01[2], b01->next->next);
+	TEST_ASSERT_EQUAL_STRING("b03", b01[2].command_name);
+	TEST_ASSERT_NOT_NULL(b01[2].next);
+	TEST_ASSERT_NULL(c->reg->common_tail->next);
+	TEST_ASSERT_EQUAL_UINT32(4, match_cnt_get(c, "b0"));
+
+	strcpy(c->input_buff, "b02");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_02_call_cnt);
+#ifdef ENABLE_COMMAND_STATS
+	TEST_ASSERT_EQUAL_UINT32(1, b01[1].stats->calls);
+	TEST_ASSERT_EQUAL_UINT32(0, b01[2].stats->calls);
+#endif
+
+#ifdef ENABLE_USER_MANAGEMENT
+	struct cli_user *u = cli_add_user(c, (struct cli_user_settings) 
+					  {
+						  .name = "u",
+						  .prompt = "u>",
+					  });
+	TEST_ASSERT_NOT_NULL(u);
+	TEST_ASSERT_EQUAL_PTR(u, c->reg->users_tail);
+	malloc_cnt = 0;
+	TEST_ASSERT_TRUE(cli_user_add_cmds(u, cs, 2));
+	TEST_ASSERT_TRUE(cli_user_add_cmd(u, cs[2]));
+	TEST_ASSERT_EQUAL_UINT32(2, malloc_cnt);
+	TEST_ASSERT_EQUAL_STRING("b01", u->cmd_list->command_name);
+	TEST_ASSERT_EQUAL_PTR(u->cmd_tail, u->cmd_list->next->next);
+	TEST_ASSERT_EQUAL_STRING("b03", u->cmd_tail->command_name);
+#endif
 }
 
 void test_cli_search_command(void)
@@ -224,14 +502,11 @@ void test_cli_search_command(void)
 			   });
 //	cli_add_cmd_common(cli_default, &cli_f01);
 
-	struct cli_cmd *t1 = cli_search_command(cli_default, 
-						"f01",
-						false, 0, NULL, NULL);
+	const struct cli_cmd *t1 = cli_search_command(cli_default, "f01");
 
 	//TEST_ASSERT_EQUAL_PTR(&cli_f01, t1);
 
-	t1 = cli_search_command(cli_default, "f02", 
-				false, 0, NULL, NULL);
+	t1 = cli_search_command(cli_default, "f02");
 	TEST_ASSERT_NULL(t1);
 
 //	cli_add_cmd_common(cli_default, &cli_f02);
@@ -243,8 +518,7 @@ void test_cli_search_command(void)
 				   .command_function = cli_function_02,
 			   });
 
-	t1 = cli_search_command(cli_default, "f02",
-				false, 0, NULL, NULL);
+	t1 = cli_search_command(cli_default, "f02");
 	//TEST_ASSERT_EQUAL_PTR(&cli_f02, t1);
 }
 
@@ -303,6 +577,84 @@ void test_cli_handle_input(void)
 	// TODO: test delete character
 }
 
+#ifdef ENABLE_SUBCOMMANDS
+void test_cli_subcommands(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &eth_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// leaf command gets its own name as argv[0]
+	strcpy(c->input_buff, "eth phy  read 0x10");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(1, phy_read_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(2, phy_read_argc);
+	TEST_ASSERT_EQUAL_STRING("read", phy_read_argv[0]);
+	TEST_ASSERT_EQUAL_STRING("0x10", phy_read_argv[1]);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_OK, c->status);
+#ifdef ENABLE_COMMAND_STATS
+	TEST_ASSERT_EQUAL_UINT32(1, phy_cmds[0].stats->calls);
+#endif
+
+	strcpy(c->input_buff, "eth stat");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_02_call_cnt);
+
+	// group alone prints help of its level only
+	send_char_buff_index = 0;
+	strcpy(c->input_buff, "eth phy");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_OK, c->status);
+	const char *expected = "read\r\n\tread phy register\r\n"
+		"reset\r\n\treset phy\r\n";
+	TEST_ASSERT_EQUAL_MEMORY(expected, send_char_buff, strlen(expected));
+	TEST_ASSERT_EQUAL_size_t(strlen(expected), send_char_buff_index);
+
+	c->status = CLI_STATUS_OK;
+	strcpy(c->input_buff, "eth phy foo");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_UNKNOWN_CMD, c->status);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_01_call_cnt);
+
+	// subcommands are not top level commands
+	strcpy(c->input_buff, "read");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_UNKNOWN_CMD, c->status);
+	TEST_ASSERT_EQUAL_UINT32(1, phy_read_call_cnt);
+}
+
+#ifdef ENABLE_AUTOCOMPLETE
+void test_cli_subcommands_autocomplete(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &eth_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "eth s\t";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("eth stat", c->input_buff);
+
+	// common part first, then the matches of this level are listed
+	test_input = "\b\b\b\bphy r\t";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("eth phy re", c->input_buff);
+
+	send_char_buff_index = 0;
+	test_input = "\t";
+	cli_run(c, 0);
+	const char *expected = "\nread\nreset\n\r\ncli>eth phy re";
+	TEST_ASSERT_EQUAL_MEMORY(expected, send_char_buff, strlen(expected));
+
+	test_input = "a\t 1\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, phy_read_call_cnt);
+	TEST_ASSERT_EQUAL_STRING("1", phy_read_argv[1]);
+}
+#endif
+#endif
+
 #ifdef ENABLE_ARGUMENT_PARSER
 void test_cli_argument_parser_normal(void)
 {
@@ -356,4 +708,1848 @@ void test_cli_argument_parser_max_len_cmd(void)
 
 }
 
+void test_cli_argument_parser_spaces_and_quotes(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	strcpy(cli_default->input_buff, "  w  \"a b\"\t\"\" c  ");
+
+	cli_argumument_parser_reset(cli_default);
+	TEST_ASSERT_EQUAL_UINT32(4, 
+				 cli_argument_parser_get_argc(cli_default));
+
+	char *argv[8];
+	uint32_t argc = cli_argument_parser_get_argv(cli_default, argv, 8);
+	TEST_ASSERT_EQUAL_UINT32(4, argc);
+	TEST_ASSERT_EQUAL_STRING("w", argv[0]);
+	TEST_ASSERT_EQUAL_STRING("a b", argv[1]);
+	TEST_ASSERT_EQUAL_STRING("", argv[2]);
+	TEST_ASSERT_EQUAL_STRING("c", argv[3]);
+
+	TEST_ASSERT_EQUAL_PTR(argv[3], 
+			      cli_argumument_parser_get_next(cli_default, 3));
+	TEST_ASSERT_EQUAL_UINT32(2, cli_argument_parser_get_argv(
+					 cli_default, argv, 2));
+}
+
+void test_cli_argument_parser_max_args(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	char ref_str[CLI_COMMAND_BUFF_SIZE];
+	memset(ref_str, 0, sizeof(ref_str));
+	for (uint32_t i = 0; (CLI_MAX_ARGS + 2) > i; i++)
+	{
+		strcat(ref_str, "a ");
+	}
+	strcpy(cli_default->input_buff, ref_str);
+
+	// arguments over the limit are an error, not dropped
+	TEST_ASSERT_EQUAL_STRING("E: too many arguments", 
+				 cli_argumument_parser_reset(cli_default));
+	TEST_ASSERT_EQUAL_UINT32(CLI_MAX_ARGS, 
+				 cli_argument_parser_get_argc(cli_default));
+	TEST_ASSERT_EQUAL_STRING(
+		"a", cli_argumument_parser_get_next(cli_default, 
+						    CLI_MAX_ARGS - 1));
+
+	// max number of arguments with spaces after them is fine
+	ref_str[2 * CLI_MAX_ARGS] = '\0';
+	strcpy(cli_default->input_buff, ref_str);
+	TEST_ASSERT_NULL(cli_argumument_parser_reset(cli_default));
+	TEST_ASSERT_EQUAL_UINT32(CLI_MAX_ARGS, 
+				 cli_argument_parser_get_argc(cli_default));
+
+	// command is not called
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f01",
+				   .command_function = cli_function_01,
+			   });
+	strcpy(cli_default->input_buff, "f01 1 2 3 4 5 6 7 8");
+	cli_command_received_handler(cli_default, cli_default->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_01_call_cnt);
+#ifdef ENABLE_COMMAND_STATUS
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_BAD_ARGS, cli_default->status);
+#endif
+}
+
+void test_cli_argument_parser_text_after_quote(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	strcpy(cli_default->input_buff, "w \"a\"b");
+	TEST_ASSERT_EQUAL_STRING("E: text after quote",
+				 cli_argumument_parser_reset(cli_default));
+
+	// quote inside an unquoted argument is a normal character
+	strcpy(cli_default->input_buff, "w a\"b\" \"c\"");
+	TEST_ASSERT_NULL(cli_argumument_parser_reset(cli_default));
+	TEST_ASSERT_EQUAL_UINT32(3, 
+				 cli_argument_parser_get_argc(cli_default));
+	TEST_ASSERT_EQUAL_STRING(
+		"a\"b\"", cli_argumument_parser_get_next(cli_default, 1));
+	TEST_ASSERT_EQUAL_STRING(
+		"c", cli_argumument_parser_get_next(cli_default, 2));
+}
+
+#endif
+
+#ifdef ENABLE_ARGUMENT_SCHEMA
+void test_cli_arg_parse_value(void)
+{
+	union cli_arg_value v;
+	struct cli_arg a = { .name = "a", .type = CLI_ARG_INT };
+
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "-42", &v));
+	TEST_ASSERT_EQUAL_INT32(-42, v.i);
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "-2147483648", &v));
+	TEST_ASSERT_EQUAL_INT32(INT32_MIN, v.i);
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "2147483648", &v));
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "12a", &v));
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "-", &v));
+	a.min = -5;
+	a.max = 5;
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "-5", &v));
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "6", &v));
+
+	a = (struct cli_arg) { .name = "a", .type = CLI_ARG_HEX };
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "0xDEADbeef", &v));
+	TEST_ASSERT_EQUAL_HEX32(0xdeadbeef, v.u);
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "ff", &v));
+	TEST_ASSERT_EQUAL_HEX32(0xff, v.u);
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "0x", &v));
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "100000000", &v));
+	a.umin = 0x80000000u;
+	a.umax = 0xffffffffu;
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "0x80000000", &v));
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "ffffffff", &v));
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "7fffffff", &v));
+
+	a.type = CLI_ARG_BOOL;
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "on", &v));
+	TEST_ASSERT_TRUE(v.b);
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "false", &v));
+	TEST_ASSERT_FALSE(v.b);
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "yes", &v));
+
+	a.type = CLI_ARG_ENUM;
+	a.enum_values = mode_values;
+	TEST_ASSERT_TRUE(cli_arg_parse_value(&a, "fast", &v));
+	TEST_ASSERT_EQUAL_UINT32(1, v.u);
+	TEST_ASSERT_FALSE(cli_arg_parse_value(&a, "fas", &v));
+}
+
+void test_cli_argument_schema(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+	TEST_ASSERT_TRUE(cli_add_cmd_common(
+				 cli_default, (struct cli_cmd_settings) {
+					 .command_name = "mem",
+					 .command_function = cli_schema_function,
+					 .args = mem_args,
+					 .arg_cnt = CLI_ARG_CNT(mem_args),
+				 }));
+	cli_schema_function_call_cnt = 0;
+
+	strcpy(cli_default->input_buff, "mem -m fast 0x10 -v 8");
+	cli_command_received_handler(cli_default, cli_default->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_schema_function_call_cnt);
+	TEST_ASSERT_EQUAL_HEX32(0x10, schema_args[0].u);
+	TEST_ASSERT_EQUAL_INT32(8, schema_args[1].i);
+	TEST_ASSERT_TRUE(schema_args[2].b);
+	TEST_ASSERT_EQUAL_UINT32(1, schema_args[3].u);
+	TEST_ASSERT_TRUE(schema_len_given);
+
+	// optional arguments are zero if not given
+	strcpy(cli_default->input_buff, "mem 20");
+	cli_command_received_handler(cli_default, cli_default->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(2, cli_schema_function_call_cnt);
+	TEST_ASSERT_EQUAL_HEX32(0x20, schema_args[0].u);
+	TEST_ASSERT_EQUAL_INT32(0, schema_args[1].i);
+	TEST_ASSERT_FALSE(schema_args[2].b);
+	TEST_ASSERT_FALSE(schema_len_given);
+
+	// bad input is rejected before the command is called
+	const char *bad[][2] = {
+		{ "mem", "E: missing addr\r\n" },
+		{ "mem 1 65", "E: invalid len\r\n" },
+		{ "mem 1 2 3", "E: too many arguments\r\n" },
+		{ "mem 1 -m", "E: missing mode\r\n" },
+		{ "mem 1 -m medium", "E: invalid mode\r\n" },
+		{ "mem x", "E: invalid addr\r\n" },
+	};
+	for (uint32_t i = 0; (sizeof(bad) / sizeof(bad[0])) > i; i++)
+	{
+		memset(send_char_buff, 0, sizeof(send_char_buff));
+		send_char_buff_index = 0;
+		strcpy(cli_default->input_buff, bad[i][0]);
+		cli_command_received_handler(cli_default, 
+					     cli_default->input_buff);
+		TEST_ASSERT_EQUAL_STRING(bad[i][1], (char *) send_char_buff);
+	}
+	TEST_ASSERT_EQUAL_UINT32(2, cli_schema_function_call_cnt);
+
+#ifdef ENABLE_STATIC_COMMANDS
+	strcpy(cli_default->input_buff, "mrd 1 -v");
+	cli_command_received_handler(cli_default, cli_default->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(3, cli_schema_function_call_cnt);
+	TEST_ASSERT_TRUE(schema_args[2].b);
+#endif
+}
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+static uint32_t test_timestamp;
+
+static uint32_t get_timestamp_test(void)
+{
+	return test_timestamp;
+}
+
+// every call takes 100 units
+static void cli_function_slow(struct cli *cli, char *s)
+{
+	(void)(cli);
+	(void)(s);
+	test_timestamp += 100;
+}
+
+void test_cli_stats_record(void)
+{
+	struct cli_cmd_stats st;
+	memset(&st, 0, sizeof(st));
+
+	cli_stats_record(&st, 0);
+	cli_stats_record(&st, 1);
+	cli_stats_record(&st, 3);
+	cli_stats_record(&st, 4);
+	cli_stats_record(&st, UINT32_MAX);
+
+	TEST_ASSERT_EQUAL_UINT32(5, st.calls);
+	TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, st.max_time);
+	TEST_ASSERT_EQUAL_UINT16(1, st.time_hist[0]);
+	TEST_ASSERT_EQUAL_UINT16(1, st.time_hist[1]);
+	TEST_ASSERT_EQUAL_UINT16(1, st.time_hist[2]);
+	TEST_ASSERT_EQUAL_UINT16(1, st.time_hist[3]);
+	TEST_ASSERT_EQUAL_UINT16(1, st.time_hist[CLI_STATS_HIST_SIZE - 1]);
+}
+
+void test_cli_stats_cmd(void)
+{
+	test_input = "slow\nslow\nhelp\nstats\n";
+	test_timestamp = 0;
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+			.get_timestamp = get_timestamp_test,
+		}, &(struct cli_cmd_settings) {
+			.command_name = "slow",
+			.command_function = cli_function_slow,
+		});
+	TEST_ASSERT_NOT_NULL(c);
+
+	cli_run(c, 0);
+
+	const struct cli_cmd *slow = cli_search_command(c, "slow");
+	TEST_ASSERT_EQUAL_UINT32(2, slow->stats->calls);
+	TEST_ASSERT_EQUAL_UINT32(100, slow->stats->max_time);
+	TEST_ASSERT_EQUAL_UINT16(2, slow->stats->time_hist[7]);
+
+	TEST_ASSERT_NOT_NULL(strstr((char *) send_char_buff, 
+				    "help: 1 calls, max 0\r\n\t<1:1 \r\n"));
+	TEST_ASSERT_NOT_NULL(strstr((char *) send_char_buff, 
+				    "slow: 2 calls, max 100\r\n\t<128:2 \r\n"));
+	// stats itself is counted after it prints
+	TEST_ASSERT_NULL(strstr((char *) send_char_buff, "stats:"));
+}
+#endif
+
+#ifdef ENABLE_COMMAND_INDEX
+void test_cli_command_index(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	const char *names[] = {"f02", "abc", "f01", "f01x"};
+	for (uint32_t i = 0; 4 > i; i++)
+	{
+		cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+				   {
+					   .command_name = names[i],
+					   .command_function = cli_function_01,
+				   });
+	}
+
+	TEST_ASSERT_TRUE(cli_build_command_index(cli_default));
+	TEST_ASSERT_TRUE(cli_default->reg->index_valid);
+
+	// help, su + 4 added commands + stats and static commands
+	uint32_t extra_cmd_cnt = 0;
+#ifdef ENABLE_COMMAND_STATS
+	extra_cmd_cnt += 1;
+#endif
+#ifdef ENABLE_STATIC_COMMANDS
+	extra_cmd_cnt += 2;
+#ifdef ENABLE_ARGUMENT_SCHEMA
+	extra_cmd_cnt += 1;
+#endif
+#endif
+	TEST_ASSERT_EQUAL_UINT32(6 + extra_cmd_cnt,
+				 cli_default->reg->common_index.cnt);
+	for (uint32_t i = 1; cli_default->reg->common_index.cnt > i; i++)
+	{
+		TEST_ASSERT_TRUE(
+			0 > strcmp(
+				cli_default->reg->common_index.cmds[i-1]->command_name,
+				cli_default->reg->common_index.cmds[i]->command_name));
+	}
+
+	const struct cli_cmd *t1 = cli_search_command(cli_default, "f01 1 2");
+	TEST_ASSERT_NOT_NULL(t1);
+	TEST_ASSERT_EQUAL_STRING("f01", t1->command_name);
+
+	TEST_ASSERT_NULL(cli_search_command(cli_default, "f0"));
+
+	TEST_ASSERT_EQUAL_UINT32(3, match_cnt_get(cli_default, "f0"));
+
+	// commands added after the index is built are still found
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "zzz",
+				   .command_function = cli_function_02,
+			   });
+	TEST_ASSERT_FALSE(cli_default->reg->index_valid);
+	TEST_ASSERT_NOT_NULL(cli_search_command(cli_default, "zzz"));
+}
+
+void test_cli_command_index_autocomplete_list(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	const char *names[] = {"f02", "f01"};
+	for (uint32_t i = 0; 2 > i; i++)
+	{
+		cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+				   {
+					   .command_name = names[i],
+					   .command_function = cli_function_01,
+				   });
+	}
+	cli_build_command_index(cli_default);
+
+	struct cli_cmd_iter it;
+	const struct cli_cmd *c = cli_match_first(cli_default, &it, "f", 1);
+	TEST_ASSERT_EQUAL_STRING("f01", c->command_name);
+	c = cli_match_next(cli_default, &it, "f", 1);
+	TEST_ASSERT_EQUAL_STRING("f02", c->command_name);
+	TEST_ASSERT_NULL(cli_match_next(cli_default, &it, "f", 1));
+}
+#endif
+
+#ifdef ENABLE_STATIC_COMMANDS
+void test_cli_static_commands(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	const struct cli_cmd *t1 = cli_search_command(cli_default, "s02");
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s02, t1);
+
+	TEST_ASSERT_EQUAL_UINT32(2, match_cnt_get(cli_default, "s0"));
+
+	cli_static_function_call_cnt = 0;
+	cli_command_received_handler(cli_default, "s01");
+	TEST_ASSERT_EQUAL_UINT32(1, cli_static_function_call_cnt);
+
+	// static commands are searched after the common commands
+	// and are also part of the index
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f01",
+				   .command_function = cli_function_01,
+			   });
+	TEST_ASSERT_TRUE(cli_build_command_index(cli_default));
+	t1 = cli_search_command(cli_default, "s01");
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s01, t1);
+}
+#endif
+
+#ifdef ENABLE_PRINTF
+// output of cli_printf as a string
+static const char *printf_get(void)
+{
+	send_char_buff[send_char_buff_index] = 0;
+	send_char_buff_index = 0;
+	return (char *) send_char_buff;
+}
+
+void test_cli_printf(void)
+{
+	struct cli *c = cli_default;
+	TEST_ASSERT_NOT_NULL(c);
+
+	cli_printf(c, "plain text");
+	TEST_ASSERT_EQUAL_STRING("plain text", printf_get());
+
+	cli_printf(c, "%d %i %u %d", 0, -42, 4000000000u, INT32_MIN);
+	TEST_ASSERT_EQUAL_STRING("0 -42 4000000000 -2147483648", 
+				 printf_get());
+
+	cli_printf(c, "%x %X %08x %lx", 0xbeefu, 0xbeefu, 0x1au, 0xfffful);
+	TEST_ASSERT_EQUAL_STRING("beef BEEF 0000001a ffff", printf_get());
+
+	cli_printf(c, "[%5d][%-5d][%05d][%2d]", 42, 42, -42, 1234);
+	TEST_ASSERT_EQUAL_STRING("[   42][42   ][-0042][1234]", printf_get());
+
+	cli_printf(c, "[%s][%6s][%-6s][%c%%]", "reg", "reg", "reg", 'x');
+	TEST_ASSERT_EQUAL_STRING("[reg][   reg][reg   ][x%]", printf_get());
+
+	cli_printf(c, "%ld %lu", -1l, 123456ul);
+	TEST_ASSERT_EQUAL_STRING("-1 123456", printf_get());
+
+	cli_printf(c, "[%zu] [%hu] [%hd] [%hhx] [%d]", (size_t) 5, 
+		   (unsigned short) 6, (short) -7, (unsigned char) 0xab, 8);
+	TEST_ASSERT_EQUAL_STRING("[5] [6] [-7] [ab] [8]", printf_get());
+
+	char p[32];
+	snprintf(p, sizeof(p), "%p|%s", (void *) c, "x");
+	cli_printf(c, "%p|%s", (void *) c, "x");
+	TEST_ASSERT_EQUAL_STRING(p, printf_get());
+
+	// arguments after an unsupported conversion are not read
+	cli_printf(c, "%d %lld %s", 1, 2ll, "x");
+	TEST_ASSERT_EQUAL_STRING("1 %lld %s", printf_get());
+
+	// padding longer than the pad buffer
+	cli_printf(c, "%20d|", 7);
+	TEST_ASSERT_EQUAL_STRING("                   7|", printf_get());
+
+	cli_write(c, "abc", 2);
+	TEST_ASSERT_EQUAL_STRING("ab", printf_get());
+}
+#endif
+
+#ifdef ENABLE_OUTPUT_BUFFER
+static uint32_t send_buf_cnt_at_cmd_call;
+
+static void cli_function_check_flush(struct cli *cli, char *s)
+{
+	(void)(cli);
+	(void)(s);
+	send_buf_cnt_at_cmd_call = send_buf_call_cnt;
+}
+
+void test_cli_output_buffer(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+			.send_buf = send_buf_test,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// echo, end sequence and prompt are sent as one block
+	test_input = "ab\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, send_buf_call_cnt);
+	TEST_ASSERT_EQUAL_size_t(strlen("ab\r\ncli>"), 
+				 send_char_buff_index);
+	TEST_ASSERT_EQUAL_MEMORY("ab\r\ncli>", send_char_buff, 
+				 send_char_buff_index);
+
+	// echo is flushed before command is called
+	cli_add_cmd_common(c, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f",
+				   .command_function = cli_function_check_flush,
+			   });
+	send_buf_call_cnt = 0;
+	send_buf_cnt_at_cmd_call = 0;
+	test_input = "f\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, send_buf_cnt_at_cmd_call);
+	TEST_ASSERT_EQUAL_UINT32(2, send_buf_call_cnt);
+}
+
+void test_cli_output_buffer_overflow(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+			.send_buf = send_buf_test,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	char str[CLI_OUTPUT_BUFF_SIZE + 11];
+	memset(str, 'x', sizeof(str));
+	str[sizeof(str) - 1] = '\0';
+
+	echo_string(c, "a");
+	echo_string(c, str);
+	TEST_ASSERT_EQUAL_UINT32(1, send_buf_call_cnt);
+	cli_output_flush(c);
+	TEST_ASSERT_EQUAL_UINT32(2, send_buf_call_cnt);
+	TEST_ASSERT_EQUAL_size_t(sizeof(str), send_char_buff_index);
+
+	// when buffer is empty, big blocks are not copied
+	echo_string(c, str);
+	TEST_ASSERT_EQUAL_UINT32(3, send_buf_call_cnt);
+}
+#endif
+
+#ifdef ENABLE_BULK_INPUT
+void test_cli_bulk_input(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_buf = get_buf_from_string,
+		}, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// output must be the same as when input is read char by char
+	test_input = "f01 abc\r\nxy\b\nf01\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(2, cli_function_01_call_cnt);
+
+	const char *expected = 
+		"f01 abc\r\ncli>xy\b \b\r\ncli>f01\r\ncli>";
+	TEST_ASSERT_EQUAL_size_t(strlen(expected), send_char_buff_index);
+	TEST_ASSERT_EQUAL_MEMORY(expected, send_char_buff,
+				 send_char_buff_index);
+}
+
+#ifdef ENABLE_LINE_EDITING
+void test_cli_bulk_input_line_editing(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_buf = get_buf_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// sequence split over chunks, insert after it
+	test_input = "f01 ac\x1b[Dbx\x1b[C";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 abxc", c->input_buff);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_tail);
+	TEST_ASSERT_EQUAL_STRING("f01 ac\bbc\bxc\bc", 
+				 (char *) send_char_buff);
+}
+#endif
+
+void test_cli_bulk_input_too_long(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_buf = get_buf_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	char str[CLI_COMMAND_BUFF_SIZE + 10];
+	memset(str, 'x', sizeof(str));
+	str[sizeof(str) - 1] = '\0';
+
+	test_input = str;
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_size_t(CLI_COMMAND_BUFF_SIZE - 1, 
+				 c->input_buff_index);
+	TEST_ASSERT_EQUAL_size_t(CLI_COMMAND_BUFF_SIZE - 1, 
+				 send_char_buff_index);
+}
+
+#ifdef ENABLE_USER_MANAGEMENT
+void test_cli_bulk_input_user_input(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_buf = get_buf_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	struct cli_user *u = cli_add_user(
+		c, (struct cli_user_settings)
+		{
+			.name = "bar",
+			.prompt = "bar>",
+		});
+
+	// su reads the user name from the same chunk
+	test_input = "su\nbar\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_PTR(u, c->current_user);
+}
+#endif
+#endif
+
+#ifdef ENABLE_ISR_INPUT
+void test_cli_isr_input(void)
+{
+	// no input callback, input comes from the ring
+	struct cli *c = test_cli_get((struct cli_settings) { 0 }, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// chunk is handled in place, same output as with get_buf
+	const char *in = "f01 abc\r\nxy\b\n";
+	TEST_ASSERT_EQUAL_size_t(strlen(in), 
+				 cli_push_buf_from_isr(c, in, strlen(in)));
+	TEST_ASSERT_TRUE(cli_push_char_from_isr(c, 'f'));
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_STRING("f01 abc\r\ncli>xy\b \b\r\ncli>f", 
+				 (char *) send_char_buff);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_isr_overrun_cnt(c));
+
+	TEST_ASSERT_EQUAL_size_t(3, cli_push_buf_from_isr(c, "01\n", 3));
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(2, cli_function_01_call_cnt);
+}
+
+void test_cli_isr_input_overrun(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) { 0 }, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	char buf[CLI_ISR_RING_SIZE + 8];
+	memset(buf, 'x', sizeof(buf));
+
+	// ring is full, the rest is counted
+	TEST_ASSERT_EQUAL_size_t(CLI_ISR_RING_SIZE - 1, 
+				 cli_push_buf_from_isr(c, buf, 
+						       CLI_ISR_RING_SIZE - 1));
+	TEST_ASSERT_EQUAL_size_t(1, cli_push_buf_from_isr(c, buf, 5));
+	TEST_ASSERT_FALSE(cli_push_char_from_isr(c, 'x'));
+	TEST_ASSERT_EQUAL_UINT32(5, cli_isr_overrun_cnt(c));
+
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(c->rx_head, c->rx_tail);
+
+	// wraps around the end of the ring
+	c->input_buff_index = 0;
+	TEST_ASSERT_EQUAL_size_t(5, cli_push_buf_from_isr(c, "\nf01\n", 5));
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(CLI_ISR_RING_SIZE + 5, c->rx_tail);
+}
+#endif
+
+#ifdef ENABLE_USER_MANAGEMENT
+static bool user_foo_password_check(char *d)
+{
+	return 0 == strcmp(d, "lol");
+}
+
+void test_cli_su_non_blocking(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	struct cli_user *foo = cli_add_user(
+		c, (struct cli_user_settings)
+		{
+			.name = "foo",
+			.password_check = user_foo_password_check,
+			.prompt = "foo>",
+		});
+
+	// cli_run returns while waiting for the user name
+	test_input = "su\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->input_handler);
+	TEST_ASSERT_EQUAL_STRING("su\r\nuser: ", (char *) send_char_buff);
+
+	test_input = "foo\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->input_handler);
+	TEST_ASSERT_TRUE(c->input_hide);
+	TEST_ASSERT_EQUAL_PTR(&c->reg->users, c->current_user);
+
+	// password is not echoed
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "lol\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->input_handler);
+	TEST_ASSERT_EQUAL_PTR(foo, c->current_user);
+	TEST_ASSERT_EQUAL_STRING("***\r\nfoo>", (char *) send_char_buff);
+}
+
+void test_cli_su_wrong_password(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	cli_add_user(c, (struct cli_user_settings)
+		     {
+			     .name = "foo",
+			     .password_check = user_foo_password_check,
+			     .prompt = "foo>",
+		     });
+
+	test_input = "su foo\nbad\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->input_handler);
+	TEST_ASSERT_NULL(c->su_user);
+	TEST_ASSERT_EQUAL_PTR(&c->reg->users, c->current_user);
+}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+void test_cli_su_cancel(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+
+	cli_add_user(c, (struct cli_user_settings)
+		     {
+			     .name = "foo",
+			     .password_check = user_foo_password_check,
+			     .prompt = "foo>",
+		     });
+
+	// Ctrl-C while the password is requested, the next line is a
+	// command again and is echoed
+	test_input = "su foo\nlo\x03";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->input_handler);
+	TEST_ASSERT_FALSE(c->input_hide);
+	TEST_ASSERT_NULL(c->su_user);
+
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "lol\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_PTR(&c->reg->users, c->current_user);
+	TEST_ASSERT_EQUAL_STRING("lol\r\ncli>", (char *) send_char_buff);
+}
+#endif
+#endif
+
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+void test_cli_run_next_ms_logout(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+			.logout_time_ms = 1000,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+	struct cli_user *u = cli_add_user(c, (struct cli_user_settings)
+					  {
+						  .name = "bar",
+						  .prompt = "bar>",
+					  });
+	TEST_ASSERT_NOT_NULL(u);
+
+	// guest is never logged out
+	TEST_ASSERT_EQUAL_UINT32(CLI_RUN_IDLE, cli_run(c, 5000));
+
+	test_input = "su\nbar\n";
+	TEST_ASSERT_EQUAL_UINT32(1001, cli_run(c, 0));
+	TEST_ASSERT_EQUAL_PTR(u, c->current_user);
+	TEST_ASSERT_EQUAL_UINT32(701, cli_run(c, 300));
+
+	// input restarts the timer
+	test_input = "x";
+	TEST_ASSERT_EQUAL_UINT32(1001, cli_run(c, 100));
+
+	TEST_ASSERT_EQUAL_UINT32(1, cli_run(c, 1000));
+	TEST_ASSERT_EQUAL_UINT32(CLI_RUN_IDLE, cli_run(c, 1));
+	TEST_ASSERT_TRUE(u != c->current_user);
+}
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+static bool cli_step_function_endless(struct cli *cli, char *s, 
+				      uint32_t step)
+{
+	(void)(cli);
+	(void)(s);
+	return CLI_STEP_CANCEL != step;
+}
+
+void test_cli_logout_running_command(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+			.logout_time_ms = 100,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+	struct cli_user *u = cli_add_user(c, (struct cli_user_settings)
+					  {
+						  .name = "adm",
+						  .prompt = "adm>",
+					  });
+	const struct cli_cmd_settings cs = {
+		.command_name = "erase",
+		.command_step = cli_step_function_endless,
+	};
+	TEST_ASSERT_TRUE(cli_user_add_cmds(u, &cs, 1));
+
+	test_input = "su adm\nerase\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+
+	// user is not logged out while the command runs
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	TEST_ASSERT_EQUAL_UINT32(0, cli_run(c, 50));
+	TEST_ASSERT_EQUAL_UINT32(0, cli_run(c, 60));
+	TEST_ASSERT_EQUAL_PTR(u, c->current_user);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(0, send_char_buff_index);
+
+	// idle time is counted from the end of the command
+	test_input = "\x03";
+	cli_run(c, 60);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(41, cli_run(c, 60));
+	TEST_ASSERT_EQUAL_PTR(u, c->current_user);
+	cli_run(c, 50);
+	TEST_ASSERT_TRUE(u != c->current_user);
+}
+#endif
+#endif
+
+#ifdef ENABLE_ROLES
+#define ROLE_ADMIN (1u << 0)
+#define ROLE_SERVICE (1u << 1)
+
+void test_cli_roles(void)
+{
+	struct cli *c = cli_default;
+	const struct cli_cmd_settings cs[] = {
+		{ .command_name = "r_all", .command_function = cli_function_01 },
+		{ .command_name = "r_adm", .command_function = cli_function_01,
+		  .roles = ROLE_ADMIN },
+		{ .command_name = "r_svc", .command_function = cli_function_02,
+		  .roles = ROLE_ADMIN | ROLE_SERVICE },
+	};
+	TEST_ASSERT_TRUE(cli_add_cmds(c, cs, 3));
+
+	struct cli_user *adm = cli_add_user(c, (struct cli_user_settings)
+					    {
+						    .name = "adm",
+						    .prompt = "adm>",
+						    .roles = ROLE_ADMIN,
+					    });
+	struct cli_user *svc = cli_add_user(c, (struct cli_user_settings)
+					    {
+						    .name = "svc",
+						    .prompt = "svc>",
+						    .roles = ROLE_SERVICE,
+					    });
+
+	// one bitmask check per command, in lists and in the index
+	for (uint32_t i = 0; 2 > i; i++)
+	{
+		TEST_ASSERT_EQUAL_UINT32(1, match_cnt_get(c, "r_"));
+		TEST_ASSERT_NULL(cli_search_command(c, "r_adm"));
+
+		cli_change_current_user(c, svc);
+		TEST_ASSERT_EQUAL_UINT32(2, match_cnt_get(c, "r_"));
+		TEST_ASSERT_NULL(cli_search_command(c, "r_adm"));
+		TEST_ASSERT_NOT_NULL(cli_search_command(c, "r_svc"));
+
+		cli_change_current_user(c, adm);
+		TEST_ASSERT_EQUAL_UINT32(3, match_cnt_get(c, "r_"));
+		TEST_ASSERT_NOT_NULL(cli_search_command(c, "r_adm"));
+
+		cli_change_current_user(c, &c->reg->users);
+#ifdef ENABLE_COMMAND_INDEX
+		TEST_ASSERT_TRUE(cli_build_command_index(c));
+#else
+		break;
+#endif
+	}
+
+	strcpy(c->input_buff, "r_svc");
+	cli_command_received_handler(c, c->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_02_call_cnt);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_UNKNOWN_CMD, c->status);
+}
+#endif
+
+#ifdef ENABLE_SCRIPT
+static void cli_function_fail(struct cli *cli, char *s)
+{
+	(void)(s);
+	cli_set_status(cli, 5);
+}
+
+void test_cli_exec_script(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f01",
+				   .command_function = cli_function_01,
+			   });
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "fail",
+				   .command_function = cli_function_fail,
+			   });
+
+	// partially typed input is kept
+	strcpy(cli_default->input_buff, "he");
+	cli_default->input_buff_index = 2;
+	cli_function_01_call_cnt = 0;
+
+	const char script[] = 
+		"# comment\r\n"
+		"f01\r\n"
+		"\n"
+		"  f01 1 2  \n"
+		"fail\n"
+		"unknown\n"
+		"f01 this line is too long for the buffer\n"
+		"f01";
+	struct cli_script_result r;
+
+	TEST_ASSERT_FALSE(cli_exec_script(cli_default, script, 
+					  sizeof(script) - 1, false, &r));
+	TEST_ASSERT_EQUAL_UINT32(3, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(6, r.executed);
+	TEST_ASSERT_EQUAL_UINT32(3, r.failed);
+	TEST_ASSERT_EQUAL_UINT32(5, r.error_line);
+	TEST_ASSERT_EQUAL_INT32(5, r.error_status);
+
+	// no echo, prompt or history
+	TEST_ASSERT_EQUAL_UINT32(0, send_char_buff_index);
+	TEST_ASSERT_EQUAL_STRING("he", cli_default->input_buff);
+	TEST_ASSERT_EQUAL_UINT32(2, cli_default->input_buff_index);
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+	TEST_ASSERT_EQUAL_UINT32(0, cli_default->history_used);
+#endif
+
+	// stops at the first error
+	cli_function_01_call_cnt = 0;
+	TEST_ASSERT_FALSE(cli_exec_script(cli_default, "unknown\nf01\n", 
+					  12, true, &r));
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(1, r.executed);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_UNKNOWN_CMD, r.error_status);
+
+	TEST_ASSERT_TRUE(cli_exec_script(cli_default, "f01\n", 4, 
+					 true, NULL));
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+}
+
+#ifdef ENABLE_USER_MANAGEMENT
+void test_cli_exec_script_su(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+	struct cli_user *foo = cli_add_user(
+		cli_default, (struct cli_user_settings)
+		{
+			.name = "foo",
+			.password_check = user_foo_password_check,
+			.prompt = "foo>",
+		});
+	struct cli_script_result r;
+
+	// input requested by a command is taken from the next lines
+	TEST_ASSERT_FALSE(cli_exec_script(cli_default, "su\nfoo\nlo\n", 
+					  10, true, &r));
+	TEST_ASSERT_EQUAL_UINT32(3, r.error_line);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_FAILED, r.error_status);
+	TEST_ASSERT_EQUAL_PTR(&cli_default->reg->users, 
+			      cli_default->current_user);
+
+	TEST_ASSERT_TRUE(cli_exec_script(cli_default, "su\nfoo\nlol", 
+					 11, true, &r));
+	TEST_ASSERT_EQUAL_PTR(foo, cli_default->current_user);
+	TEST_ASSERT_NULL(cli_default->input_handler);
+}
+#endif
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+static uint8_t frame_input[256];
+static size_t frame_input_len;
+static size_t frame_input_index;
+
+static bool get_char_from_frames(char *c)
+{
+	if (frame_input_index < frame_input_len)
+	{
+		*c = (char) frame_input[frame_input_index];
+		frame_input_index += 1;
+		return true;
+	}
+	return false;
+}
+
+// appends a request frame to frame_input
+static void frame_add(uint8_t type, uint8_t seq, const char *payload)
+{
+	uint8_t *f = &frame_input[frame_input_len];
+	uint8_t len = (uint8_t) strlen(payload);
+	uint16_t crc = 0xffff;
+
+	f[0] = CLI_FRAME_SOF;
+	f[1] = type;
+	f[2] = seq;
+	f[3] = len;
+	memcpy(&f[4], payload, len);
+	for (uint32_t i = 1; (4u + len) > i; i++)
+	{
+		crc = cli_crc16(crc, f[i]);
+	}
+	f[4 + len] = (uint8_t) (crc >> 8);
+	f[5 + len] = (uint8_t) crc;
+	frame_input_len += 6u + len;
+}
+
+// checks the response frame at *pos and moves pos after it
+static void frame_check(size_t *pos, uint8_t type, uint8_t seq, 
+			const void *payload, uint8_t len)
+{
+	const uint8_t *f = &send_char_buff[*pos];
+	uint16_t crc = 0xffff;
+
+	TEST_ASSERT_EQUAL_HEX8(CLI_FRAME_SOF, f[0]);
+	TEST_ASSERT_EQUAL_HEX8(type, f[1]);
+	TEST_ASSERT_EQUAL_UINT8(seq, f[2]);
+	TEST_ASSERT_EQUAL_UINT8(len, f[3]);
+	TEST_ASSERT_EQUAL_MEMORY(payload, &f[4], len);
+	for (uint32_t i = 1; (6u + len) > i; i++)
+	{
+		crc = cli_crc16(crc, f[i]);
+	}
+	TEST_ASSERT_EQUAL_HEX16(0, crc);
+	*pos += 6u + len;
+}
+
+static void cli_function_print(struct cli *cli, char *s)
+{
+	(void)(s);
+	echo_string(cli, "hello");
+}
+
+void test_cli_crc16(void)
+{
+	uint16_t crc = 0xffff;
+	for (const char *s = "123456789"; *s; s++)
+	{
+		crc = cli_crc16(crc, (uint8_t) *s);
+	}
+	TEST_ASSERT_EQUAL_HEX16(0x29b1, crc);
+}
+
+void test_cli_machine_mode(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_frames,
+		}, NULL);
+	TEST_ASSERT_NOT_NULL(c);
+	cli_add_cmd_common(c, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "print",
+				   .command_function = cli_function_print,
+			   });
+	cli_add_cmd_common(c, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f01",
+				   .command_function = cli_function_01,
+			   });
+	cli_machine_mode(c, true);
+	cli_function_01_call_cnt = 0;
+
+	// pipelined requests, the second one is corrupted
+	frame_input_len = 0;
+	frame_input_index = 0;
+	frame_add(CLI_FRAME_CMD, 7, "print");
+	frame_add(CLI_FRAME_CMD, 8, "f01");
+	frame_input[frame_input_len - 3] ^= 1;
+	frame_add(CLI_FRAME_CMD, 9, "f01 1");
+	frame_add(CLI_FRAME_CMD, 10, "nope");
+	frame_add(CLI_FRAME_DATA, 11, "f01");
+	cli_run(c, 0);
+
+	const uint8_t ok[4] = {0, 0, 0, 0};
+	const uint8_t bad_frame[4] = {0xfb, 0xff, 0xff, 0xff};
+	const uint8_t unknown[4] = {0xfe, 0xff, 0xff, 0xff};
+	size_t pos = 0;
+	frame_check(&pos, CLI_FRAME_DATA, 7, "hello", 5);
+	frame_check(&pos, CLI_FRAME_END, 7, ok, 4);
+	frame_check(&pos, CLI_FRAME_END, 8, bad_frame, 4);
+	frame_check(&pos, CLI_FRAME_END, 9, ok, 4);
+	frame_check(&pos, CLI_FRAME_END, 10, unknown, 4);
+	frame_check(&pos, CLI_FRAME_END, 11, bad_frame, 4);
+	// no echo or prompt
+	TEST_ASSERT_EQUAL_UINT32(pos, send_char_buff_index);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+
+	// back to the human mode
+	cli_machine_mode(c, false);
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	frame_input_len = 0;
+	frame_input_index = 0;
+	memcpy(frame_input, "f01\n", 4);
+	frame_input_len = 4;
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(2, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_STRING("f01\r\ncli>", (char *) send_char_buff);
+}
+
+void test_cli_machine_mode_long_output(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+	cli_machine_mode(cli_default, true);
+
+	frame_input_len = 0;
+	frame_add(CLI_FRAME_CMD, 1, "help");
+	for (size_t i = 0; frame_input_len > i; i++)
+	{
+		cli_machine_rx(cli_default, frame_input[i]);
+	}
+
+	// output is split in full DATA frames
+	size_t pos = 0;
+	uint32_t data_len = 0;
+	while (CLI_FRAME_DATA == send_char_buff[pos + 1])
+	{
+		uint8_t len = send_char_buff[pos + 3];
+		data_len += len;
+		frame_check(&pos, CLI_FRAME_DATA, 1, 
+			    &send_char_buff[pos + 4], len);
+	}
+	TEST_ASSERT_GREATER_THAN(CLI_MACHINE_DATA_SIZE, data_len);
+	const uint8_t ok[4] = {0, 0, 0, 0};
+	frame_check(&pos, CLI_FRAME_END, 1, ok, 4);
+}
+#endif
+
+#ifdef ENABLE_RESUMABLE_COMMANDS
+void test_cli_resumable_command(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// first step when received, one more in the same cli_run
+	test_input = "steps\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(2, step_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(1, step_last);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_STRING("steps\r\n", (char *) send_char_buff);
+
+	// input is ignored while the command runs
+	test_input = "help\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(2, step_last);
+	TEST_ASSERT_EQUAL_UINT32(0, c->input_buff_index);
+
+	// prompt is printed when the command finishes
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(3, step_last);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_STRING("steps\r\ncli>", (char *) send_char_buff);
+
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(4, step_call_cnt);
+}
+
+void test_cli_run_next_ms_running(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	TEST_ASSERT_EQUAL_UINT32(CLI_RUN_IDLE, cli_run(c, 0));
+
+	// more steps pending, cli_run must be called again right away
+	test_input = "steps\n";
+	TEST_ASSERT_EQUAL_UINT32(0, cli_run(c, 0));
+	TEST_ASSERT_EQUAL_UINT32(0, cli_run(c, 0));
+	TEST_ASSERT_EQUAL_UINT32(CLI_RUN_IDLE, cli_run(c, 0));
+}
+
+void test_cli_resumable_command_cancel(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "steps\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "x\x03";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(CLI_STEP_CANCEL, step_last);
+	TEST_ASSERT_EQUAL_INT32(CLI_STATUS_CANCELLED, c->status);
+	TEST_ASSERT_EQUAL_STRING("^C\r\ncli>", (char *) send_char_buff);
+
+	// on the prompt Ctrl-C drops the line
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "ste\x03";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, c->input_buff_index);
+	TEST_ASSERT_EQUAL_STRING("ste^C\r\ncli>", (char *) send_char_buff);
+}
+
+#ifdef ENABLE_SUBCOMMANDS
+static char *step_input;
+
+// checks that every step gets the input of the first one
+static bool cli_step_function_input(struct cli *cli, char *s, uint32_t step)
+{
+	if (0 == step)
+	{
+		step_input = s;
+	}
+	TEST_ASSERT_EQUAL_PTR(step_input, s);
+	return cli_step_function(cli, s, step);
+}
+
+static const struct cli_cmd log_cmds[] = {
+	{
+		.command_name = "dump",
+		.command_step = cli_step_function_input,
+	},
+};
+
+void test_cli_resumable_subcommand(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+	cli_add_cmd_common(c, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "log",
+				   .subcmds = log_cmds,
+				   .subcmd_cnt = CLI_SUBCMD_CNT(log_cmds),
+			   });
+
+	test_input = "log dump all\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_PTR(&c->input_buff[4], step_input);
+	cli_run(c, 0);
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(4, step_call_cnt);
+
+	// cancel step gets it too
+	test_input = "log dump\n";
+	cli_run(c, 0);
+	test_input = "\x03";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(CLI_STEP_CANCEL, step_last);
+	TEST_ASSERT_EQUAL_PTR(&c->input_buff[4], step_input);
+}
+#endif
+
+#ifdef ENABLE_COMMAND_STATS
+// every step takes 100 units
+static bool cli_step_function_slow(struct cli *cli, char *s, uint32_t step)
+{
+	test_timestamp += 100;
+	return cli_step_function(cli, s, step);
+}
+
+void test_cli_resumable_command_stats(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+	c->reg->get_timestamp = get_timestamp_test;
+	test_timestamp = 0;
+	cli_add_cmd_common(c, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "slow",
+				   .command_step = cli_step_function_slow,
+			   });
+
+	// steps of one call are recorded as a single sample
+	test_input = "slow\n";
+	for (uint32_t i = 0; 4 > i; i++)
+	{
+		cli_run(c, 0);
+	}
+	const struct cli_cmd *slow = cli_search_command(c, "slow");
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(1, slow->stats->calls);
+	TEST_ASSERT_EQUAL_UINT32(400, slow->stats->max_time);
+	TEST_ASSERT_EQUAL_UINT16(1, slow->stats->time_hist[9]);
+
+	// cancelled call is recorded with the cancel step
+	test_input = "slow\n";
+	cli_run(c, 0);
+	test_input = "\x03";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(2, slow->stats->calls);
+	TEST_ASSERT_EQUAL_UINT16(2, slow->stats->time_hist[9]);
+}
+#endif
+
+#ifdef ENABLE_MACHINE_MODE
+void test_cli_resumable_command_machine_mode(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+	c->get_char = get_char_from_frames;
+	cli_machine_mode(c, true);
+
+	frame_input_len = 0;
+	frame_input_index = 0;
+	frame_add(CLI_FRAME_CMD, 1, "steps");
+	frame_add(CLI_FRAME_CMD, 2, "help");
+
+	// next request waits until the command finishes
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, send_char_buff_index);
+	TEST_ASSERT_EQUAL_UINT32(11, frame_input_index);
+	cli_run(c, 0);
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->running_cmd);
+
+	const uint8_t ok[4] = {0, 0, 0, 0};
+	size_t pos = 0;
+	frame_check(&pos, CLI_FRAME_END, 1, ok, 4);
+	TEST_ASSERT_EQUAL_UINT32(pos, send_char_buff_index);
+
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_HEX8(2, send_char_buff[pos + 2]);
+}
+#endif
+
+#ifdef ENABLE_SCRIPT
+void test_cli_resumable_command_script(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	TEST_ASSERT_TRUE(cli_exec_script(c, "steps\nsteps", 11, true, NULL));
+	TEST_ASSERT_EQUAL_UINT32(8, step_call_cnt);
+	TEST_ASSERT_NULL(c->running_cmd);
+}
+#endif
+
+#ifdef ENABLE_STREAMING_OUTPUT
+static size_t send_space_value;
+
+static size_t send_space_test(void)
+{
+	return send_space_value;
+}
+
+void test_cli_streaming_help(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &steps_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+	TEST_ASSERT_EQUAL_size_t(SIZE_MAX, cli_output_space(c));
+	c->send_space = send_space_test;
+
+	// nothing is printed while the transport is full
+	send_space_value = 0;
+	test_input = "help\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_UINT32(6, send_char_buff_index);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_run(c, 0));
+	TEST_ASSERT_EQUAL_UINT32(6, send_char_buff_index);
+
+	// at least one command per step, the next one doesnt fit
+	send_space_value = 20;
+	cli_run(c, 0);
+	TEST_ASSERT_NOT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_STRING("help\r\nhelp\r\n\tprint out all the "
+				 "commands\r\n", (char *) send_char_buff);
+
+	for (uint32_t i = 0; 100 > i && c->running_cmd; i++)
+	{
+		cli_run(c, 0);
+	}
+	TEST_ASSERT_NULL(c->running_cmd);
+	char streamed[sizeof(send_char_buff)];
+	memcpy(streamed, send_char_buff, sizeof(streamed));
+	TEST_ASSERT_NOT_NULL(strstr(streamed, "steps\r\n"));
+
+	// with enough space help is done at once, output is the same
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	send_space_value = 1000;
+	test_input = "help\n";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(c->running_cmd);
+	TEST_ASSERT_EQUAL_STRING(streamed, (char *) send_char_buff);
+}
+#endif
+#endif
+
+static uint32_t send_char_session_cnt;
+
+static void send_char_session(char c)
+{
+	(void)(c);
+	send_char_session_cnt += 1;
+}
+
+void test_cli_add_session(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	struct cli_settings s = {
+		.get_char = get_char_from_string,
+		.send_char = send_char_session,
+		.input_end_char = '\n',
+	};
+	struct cli *session = cli_add_session(cli_default, &s);
+	TEST_ASSERT_NOT_NULL(session);
+	TEST_ASSERT_EQUAL_PTR(cli_default->reg, session->reg);
+	TEST_ASSERT_NULL(cli_add_session(NULL, &s));
+
+	// commands are shared
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "f01",
+				   .command_function = cli_function_01,
+			   });
+
+	send_char_session_cnt = 0;
+	test_input = "f01\n";
+	cli_run(session, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_UINT32(strlen("f01\r\ncli>"), 
+				 send_char_session_cnt);
+	// nothing was sent to the first session
+	TEST_ASSERT_EQUAL_UINT32(0, send_char_buff_index);
+
+#ifdef ENABLE_USER_MANAGEMENT
+	struct cli_user *bar = cli_add_user(
+		cli_default, (struct cli_user_settings)
+		{
+			.name = "bar",
+			.prompt = "bar>",
+		});
+
+	// each session has its own current user
+	test_input = "su bar\n";
+	cli_run(session, 0);
+	TEST_ASSERT_EQUAL_PTR(bar, session->current_user);
+	TEST_ASSERT_EQUAL_PTR(&cli_default->reg->users, 
+			      cli_default->current_user);
+#endif
+}
+
+void test_cli_session_reset(void)
+{
+	struct cli_settings s = {
+		.get_char = get_char_from_string,
+		.send_char = send_char_test,
+		.input_end_char = '\n',
+	};
+	struct cli *session = cli_add_session(cli_default, &s);
+	TEST_ASSERT_NOT_NULL(session);
+
+	test_input = "hel";
+	cli_run(session, 0);
+	TEST_ASSERT_EQUAL_UINT32(3, session->input_buff_index);
+#ifdef ENABLE_USER_MANAGEMENT
+	cli_add_user(cli_default, (struct cli_user_settings)
+		     {
+			     .name = "bar",
+			     .prompt = "bar>",
+		     });
+	test_input = "\nsu bar\n";
+	cli_run(session, 0);
+	TEST_ASSERT_TRUE(&cli_default->reg->users != session->current_user);
+#endif
+
+	cli_session_reset(session);
+	TEST_ASSERT_EQUAL_UINT32(0, session->input_buff_index);
+	TEST_ASSERT_EQUAL_PTR(&cli_default->reg->users, 
+			      session->current_user);
+	TEST_ASSERT_TRUE(send_char_test == session->send_char);
+
+	// session works as a new one
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "help\n";
+	cli_run(session, 0);
+	TEST_ASSERT_NOT_NULL(strstr((char *) send_char_buff, "help\r\n"));
+}
+
+#if defined(ENABLE_HISTORY_V1) || defined(ENABLE_HISTORY_V2)
+static char *history_entry(struct cli *c, uint32_t n)
+{
+	if (!cli_history_put_on_prompt(c, n))
+	{
+		return NULL;
+	}
+	return c->input_buff;
+}
+
+void test_cli_history_ring(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	cli_history_save_cmd(cli_default, "aaa");
+	cli_history_save_cmd(cli_default, "bbb 1");
+	cli_history_save_cmd(cli_default, "bbb 1");
+	cli_history_save_cmd(cli_default, "");
+	cli_history_save_cmd(cli_default, "c");
+
+	// entries are packed, duplicates are collapsed
+	TEST_ASSERT_EQUAL_UINT32(strlen("aaa bbb 1 c "), 
+				 cli_default->history_used);
+	TEST_ASSERT_EQUAL_STRING("c", history_entry(cli_default, 1));
+	TEST_ASSERT_EQUAL_STRING("bbb 1", history_entry(cli_default, 2));
+	TEST_ASSERT_EQUAL_STRING("aaa", history_entry(cli_default, 3));
+	TEST_ASSERT_NULL(history_entry(cli_default, 4));
+}
+
+void test_cli_history_ring_overwrite(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	char cmd[CLI_COMMAND_BUFF_SIZE];
+	uint32_t cmd_cnt = (2 * CLI_HISTORY_SIZE) / 10;
+	for (uint32_t i = 0; cmd_cnt > i; i++)
+	{
+		snprintf(cmd, sizeof(cmd), "cmd %03" PRIu32 "..", i);
+		cli_history_save_cmd(cli_default, cmd);
+		TEST_ASSERT_TRUE(CLI_HISTORY_SIZE 
+				 >= cli_default->history_used);
+	}
+
+	// oldest entries were dropped, newest survived the wrap
+	uint32_t kept = CLI_HISTORY_SIZE / 10;
+	for (uint32_t i = 1; kept >= i; i++)
+	{
+		snprintf(cmd, sizeof(cmd), "cmd %03" PRIu32 "..", 
+			 cmd_cnt - i);
+		TEST_ASSERT_EQUAL_STRING(cmd, history_entry(cli_default, i));
+	}
+	TEST_ASSERT_NULL(history_entry(cli_default, kept + 1));
+
+	cli_history_forget(cli_default);
+	TEST_ASSERT_NULL(history_entry(cli_default, 1));
+}
+#endif
+
+#ifdef ENABLE_HISTORY_V2
+void test_cli_history_arrows(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "f01 1\nf01 2\n\x1b[A\x1b[A";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 1", c->input_buff);
+
+	test_input = "\x1b[B";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 2", c->input_buff);
+
+	// down from the newest entry clears the prompt
+	test_input = "\x1b[B";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_buff_index);
+
+	test_input = "\x1b[A\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(3, cli_function_01_call_cnt);
+}
+#endif
+
+#ifdef ENABLE_LINE_EDITING
+void test_cli_csi_len(void)
+{
+	TEST_ASSERT_EQUAL_size_t(3, cli_csi_len(1));
+	TEST_ASSERT_EQUAL_size_t(4, cli_csi_len(9));
+	TEST_ASSERT_EQUAL_size_t(5, cli_csi_len(10));
+	TEST_ASSERT_EQUAL_size_t(6, cli_csi_len(120));
+}
+
+void test_cli_line_editing_insert(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// short tail is redrawn, 1 character left is one backspace
+	test_input = "f01 ac\x1b[Db";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 abc", c->input_buff);
+	TEST_ASSERT_EQUAL_size_t(1, c->input_tail);
+	TEST_ASSERT_EQUAL_STRING("f01 ac\bbc\b", (char *) send_char_buff);
+
+	// longer tail is shifted by the terminal
+	send_char_buff_index = 0;
+	test_input = "\x1bOH_";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("_f01 abc", c->input_buff);
+	TEST_ASSERT_EQUAL_MEMORY("\x1b[6D\x1b[@_", send_char_buff, 
+				 send_char_buff_index);
+
+	// end with vt220 key, enter submits the whole line
+	send_char_buff_index = 0;
+	test_input = "\x1b[4~";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_tail);
+	TEST_ASSERT_EQUAL_MEMORY("\x1b[7C", send_char_buff, 
+				 send_char_buff_index);
+
+	test_input = "\x01\x1b[C\x1b[C\x05\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_01_call_cnt);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_buff_index);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_tail);
+}
+
+void test_cli_line_editing_delete(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "f01 xyz\x1b[D\x1b[D";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_size_t(2, c->input_tail);
+
+	// backspace in the middle
+	send_char_buff_index = 0;
+	test_input = "\b";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 yz", c->input_buff);
+	TEST_ASSERT_EQUAL_MEMORY("\b\x1b[P", send_char_buff, 
+				 send_char_buff_index);
+
+	// delete key, last one is cleared with a space
+	send_char_buff_index = 0;
+	test_input = "\x1b[3~\x1b[3~\x1b[3~";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 ", c->input_buff);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_tail);
+	TEST_ASSERT_EQUAL_MEMORY("\x1b[P \b", send_char_buff, 
+				 send_char_buff_index);
+
+	// left stops at the start of the line
+	test_input = "\x1b[H\x1b[D\b1\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(0, cli_function_01_call_cnt);
+}
+
+#ifdef ENABLE_HISTORY_V2
+void test_cli_line_editing_history(void)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, &f01_cmd);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "f01 abc\nf01 abd\n";
+	cli_run(c, 0);
+
+	// only the part after the common prefix is sent
+	send_char_buff_index = 0;
+	test_input = "\x1b[A\x1b[A";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 abc", c->input_buff);
+	TEST_ASSERT_EQUAL_MEMORY("f01 abd\bc", send_char_buff, 
+				 send_char_buff_index);
+
+	send_char_buff_index = 0;
+	test_input = "\x1b[D\x1b[D\x1b[B";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("f01 abd", c->input_buff);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_tail);
+	TEST_ASSERT_EQUAL_MEMORY("\b\bbd", send_char_buff, 
+				 send_char_buff_index);
+
+	send_char_buff_index = 0;
+	test_input = "\x1b[B";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_size_t(0, c->input_buff_index);
+	TEST_ASSERT_EQUAL_MEMORY("\x1b[7D\x1b[K", send_char_buff, 
+				 send_char_buff_index);
+}
+#endif
+#endif
+
+#ifdef ENABLE_AUTOCOMPLETE
+static const struct cli_cmd_settings autocomplete_cmds[] = {
+	{ .command_name = "eth_phy_write", 
+	  .command_function = cli_function_01 },
+	{ .command_name = "eth_mac", .command_function = cli_function_01 },
+	{ .command_name = "eth_phy_read", 
+	  .command_function = cli_function_01 },
+};
+
+static struct cli *autocomplete_cli_get(bool build_index)
+{
+	struct cli *c = test_cli_get((struct cli_settings) {
+			.get_char = get_char_from_string,
+		}, NULL);
+	cli_add_cmds(c, autocomplete_cmds, 3);
+#ifdef ENABLE_COMMAND_INDEX
+	if (build_index)
+	{
+		cli_build_command_index(c);
+	}
+#else
+	(void) build_index;
+#endif
+	return c;
+}
+
+static void autocomplete_common_prefix(bool build_index)
+{
+	struct cli *c = autocomplete_cli_get(build_index);
+	TEST_ASSERT_NOT_NULL(c);
+
+	// first tab completes the part common to all matches and
+	// sends only the missing characters
+	test_input = "eth_p\t";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("eth_phy_", c->input_buff);
+	TEST_ASSERT_EQUAL_STRING("eth_phy_", (char *) send_char_buff);
+	TEST_ASSERT_EQUAL_UINT32(2, c->ac_cnt);
+
+	// second tab lists the candidates
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "\t";
+	cli_run(c, 0);
+	const char *expected = build_index ?
+		"\neth_phy_read\neth_phy_write\n\r\ncli>eth_phy_" :
+		"\neth_phy_write\neth_phy_read\n\r\ncli>eth_phy_";
+	TEST_ASSERT_EQUAL_STRING(expected, (char *) send_char_buff);
+
+	// single match is completed
+	test_input = "w\t\n";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_UINT32(1, cli_function_01_call_cnt);
+}
+
+void test_cli_autocomplete_common_prefix(void)
+{
+	autocomplete_common_prefix(false);
+}
+
+#ifdef ENABLE_COMMAND_INDEX
+void test_cli_autocomplete_common_prefix_index(void)
+{
+	autocomplete_common_prefix(true);
+}
+#endif
+
+void test_cli_autocomplete_cache(void)
+{
+	struct cli *c = autocomplete_cli_get(false);
+	TEST_ASSERT_NOT_NULL(c);
+
+	test_input = "eth_\t";
+	cli_run(c, 0);
+	TEST_ASSERT_TRUE(c->ac_valid);
+	TEST_ASSERT_EQUAL_UINT32(3, c->ac_cnt);
+
+	// any other key drops the cached candidates
+	test_input = "m";
+	cli_run(c, 0);
+	TEST_ASSERT_FALSE(c->ac_valid);
+
+	test_input = "\t";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_STRING("eth_mac", c->input_buff);
+}
+
+#ifdef ENABLE_AUTOMATIC_LOGOUT
+void test_cli_autocomplete_after_logout(void)
+{
+	struct cli *c = autocomplete_cli_get(false);
+	TEST_ASSERT_NOT_NULL(c);
+	c->logout_time_ms = 100;
+
+	struct cli_user *u = cli_add_user(c, (struct cli_user_settings) 
+					  {
+						  .name = "adm",
+						  .prompt = "adm>",
+					  });
+	const struct cli_cmd_settings cs[] = {
+		{ .command_name = "flash_erase", 
+		  .command_function = cli_function_01 },
+		{ .command_name = "flash_write", 
+		  .command_function = cli_function_01 },
+	};
+	TEST_ASSERT_TRUE(cli_user_add_cmds(u, cs, 2));
+
+	test_input = "su adm\nfl\t";
+	cli_run(c, 0);
+	TEST_ASSERT_EQUAL_PTR(u, c->current_user);
+	TEST_ASSERT_TRUE(c->ac_valid);
+
+	// candidates of the previous user are not listed to the guest
+	cli_run(c, 200);
+	TEST_ASSERT_TRUE(u != c->current_user);
+	TEST_ASSERT_FALSE(c->ac_valid);
+
+	send_char_buff_index = 0;
+	memset(send_char_buff, 0, sizeof(send_char_buff));
+	test_input = "\t";
+	cli_run(c, 0);
+	TEST_ASSERT_NULL(strstr((char *) send_char_buff, "flash"));
+	TEST_ASSERT_NOT_NULL(strstr((char *) send_char_buff, "eth_mac"));
+}
+#endif
+#endif
+
+#ifdef ENABLE_PERFECT_HASH
+void test_cli_perfect_hash(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s01, cli_phash_search("s01", 3));
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s02, cli_phash_search("s02 1", 3));
+	TEST_ASSERT_NULL(cli_phash_search("s0", 2));
+	TEST_ASSERT_NULL(cli_phash_search("s011", 4));
+	TEST_ASSERT_NULL(cli_phash_search("help", 4));
+
+	// dynamic commands are still found
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s02, 
+			      cli_search_command(cli_default, "s02 1"));
+	TEST_ASSERT_NOT_NULL(cli_search_command(cli_default, "help"));
+	TEST_ASSERT_NULL(cli_search_command(cli_default, "s03"));
+}
+#endif
+
+#ifdef ENABLE_STATIC_COMMANDS
+void test_cli_static_command_precedence(void)
+{
+	TEST_ASSERT_NOT_NULL(cli_default);
+
+	// common command with the name of a static one wins, with or
+	// without the perfect hash
+	cli_add_cmd_common(cli_default, (struct cli_cmd_settings) 
+			   {
+				   .command_name = "s01",
+				   .command_function = cli_function_01,
+			   });
+	const struct cli_cmd *cmd = cli_search_command(cli_default, "s01");
+	TEST_ASSERT_NOT_NULL(cmd);
+	TEST_ASSERT_TRUE(&cli_cmd_s01 != cmd);
+	TEST_ASSERT_TRUE(cli_function_01 == cmd->command_function);
+	TEST_ASSERT_EQUAL_PTR(&cli_cmd_s02, 
+			      cli_search_command(cli_default, "s02"));
+}
 #endif